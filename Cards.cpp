@@ -1,10 +1,77 @@
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 using namespace std;
 
+// Matcher instrumentation
+// Every matcher takes a Stats policy. NoStats has empty inline hooks, so the
+// uninstrumented matchers compile to exactly the same loops as before.
+struct NoStats
+{
+    void comparison() {}
+    void probe() {}
+    void matched(size_t, size_t) {}
+};
+
+// MatchStats counts what a matcher did, it is only used behind --stats
+struct MatchStats
+{
+    unsigned long long comparisons = 0; // Card comparisons
+    unsigned long long probes = 0;      // Hash table lookups
+    unsigned long long ahmedWins = 0;   // Matches with i < j, the card goes to Ahmed
+    unsigned long long karimKeeps = 0;  // Matches with i > j, the card stays with Karim
+    unsigned long long samePlace = 0;   // Matches with i == j, the card is discarded
+
+    void comparison() { ++comparisons; }
+    void probe() { ++probes; }
+    void matched(size_t i, size_t j)
+    {
+        if (i < j) ++ahmedWins;
+        else if (i > j) ++karimKeeps;
+        else ++samePlace;
+    }
+};
+
+// Bytes requested from operator new while countAllocations is on (only with --stats)
+size_t allocatedBytes = 0;
+bool countAllocations = false;
+
+void* operator new(size_t size)
+{
+    if (countAllocations)
+    {
+        allocatedBytes += size;
+    }
+    if (void* p = malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+// Not inlined, so the compiler does not pair free() with the operator new above
+[[gnu::noinline]] void operator delete(void* p) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept { free(p); }
+
 // Function to process the cards and distribute them to Ahmed and Karim
-void processCards(const vector<int>& N, const vector<int>& M, vector<int>& Ahmed, vector<int>& Karim)
+template <class Stats>
+void processCards(const vector<int>& N, const vector<int>& M, vector<int>& Ahmed, vector<int>& Karim, Stats& stats)
 {
     vector<int> copy_N = N; // Create a copy of Ahmed's cards
     vector<int> copy_M = M; // Create a copy of Karim's cards
@@ -15,8 +82,10 @@ void processCards(const vector<int>& N, const vector<int>& M, vector<int>& Ahmed
         {
         for (size_t j = 0; j < copy_M.size(); ++j)
             {
+            stats.comparison();
             if (copy_N[i] == copy_M[j] && copy_N[i] != 0 && copy_M[j] != 0)
                 {
+                stats.matched(i, j);
                 if (i < j)
                 {
                     Ahmed.push_back(copy_N[i]);
@@ -42,6 +111,170 @@ void processCards(const vector<int>& N, const vector<int>& M, vector<int>& Ahmed
     }
 }
 
+void processCards(const vector<int>& N, const vector<int>& M, vector<int>& Ahmed, vector<int>& Karim)
+{
+    NoStats stats;
+    processCards(N, M, Ahmed, Karim, stats);
+}
+
+// Same result as processCards, but every card of N is matched with the earliest
+// free equal card of M through a hash map of "next equal card" chains: O(N + M).
+template <class Stats>
+void processCardsHash(const vector<int>& N, const vector<int>& M, vector<int>& Ahmed, vector<int>& Karim, Stats& stats)
+{
+    const size_t none = M.size();
+    vector<size_t> nextSame(M.size(), none); // Next position in M holding the same card
+    unordered_map<int, size_t> head;          // Card -> earliest free position in M
+    head.reserve(M.size());
+
+    // Walk M backwards so that every chain is built in ascending order
+    for (size_t j = M.size(); j-- > 0;)
+    {
+        if (M[j] == 0)
+        {
+            continue;
+        }
+        stats.probe();
+        auto it = head.find(M[j]);
+        if (it != head.end())
+        {
+            nextSame[j] = it->second;
+            it->second = j;
+        }
+        else
+        {
+            head.emplace(M[j], j);
+        }
+    }
+
+    vector<int> temp(M.size(), 0); // Karim's kept cards, indexed by their position in M
+    for (size_t i = 0; i < N.size(); ++i)
+    {
+        if (N[i] == 0)
+        {
+            continue;
+        }
+        stats.probe();
+        auto it = head.find(N[i]);
+        if (it == head.end() || it->second == none)
+        {
+            continue;
+        }
+        size_t j = it->second;
+        it->second = nextSame[j];
+        stats.matched(i, j);
+        if (i < j)
+        {
+            Ahmed.push_back(N[i]);
+        }
+        else if (i > j)
+        {
+            temp[j] = M[j];
+        }
+    }
+
+    for (int card : temp)
+    {
+        if (card != 0)
+        {
+            Karim.push_back(card);
+        }
+    }
+}
+
+// Same result as processCards, using M sorted by (card, position) and a cursor
+// per group of equal cards: O((N + M) log M) without any hashing.
+template <class Stats>
+void processCardsSorted(const vector<int>& N, const vector<int>& M, vector<int>& Ahmed, vector<int>& Karim, Stats& stats)
+{
+    auto less = [&stats](const pair<int, size_t>& a, const pair<int, size_t>& b)
+    {
+        stats.comparison();
+        return a < b;
+    };
+
+    vector<pair<int, size_t>> sorted; // (card, position in M)
+    sorted.reserve(M.size());
+    for (size_t j = 0; j < M.size(); ++j)
+    {
+        if (M[j] != 0)
+        {
+            sorted.emplace_back(M[j], j);
+        }
+    }
+    sort(sorted.begin(), sorted.end(), less);
+
+    vector<size_t> taken(sorted.size(), 0); // Cards already used, stored at each group start
+    vector<int> temp(M.size(), 0);
+    for (size_t i = 0; i < N.size(); ++i)
+    {
+        if (N[i] == 0)
+        {
+            continue;
+        }
+        auto group = lower_bound(sorted.begin(), sorted.end(), make_pair(N[i], size_t(0)), less);
+        size_t g = group - sorted.begin();
+        if (g == sorted.size() || sorted[g].first != N[i])
+        {
+            continue;
+        }
+        size_t k = g + taken[g];
+        if (k == sorted.size() || sorted[k].first != N[i])
+        {
+            continue;
+        }
+        ++taken[g];
+        size_t j = sorted[k].second;
+        stats.matched(i, j);
+        if (i < j)
+        {
+            Ahmed.push_back(N[i]);
+        }
+        else if (i > j)
+        {
+            temp[j] = M[j];
+        }
+    }
+
+    for (int card : temp)
+    {
+        if (card != 0)
+        {
+            Karim.push_back(card);
+        }
+    }
+}
+
+// Uninstrumented entry points with the signature of processCards
+void processCardsHash(const vector<int>& N, const vector<int>& M, vector<int>& Ahmed, vector<int>& Karim)
+{
+    NoStats stats;
+    processCardsHash(N, M, Ahmed, Karim, stats);
+}
+
+void processCardsSorted(const vector<int>& N, const vector<int>& M, vector<int>& Ahmed, vector<int>& Karim)
+{
+    NoStats stats;
+    processCardsSorted(N, M, Ahmed, Karim, stats);
+}
+
+// Every matcher is registered with a plain and an instrumented entry point
+typedef void (*Matcher)(const vector<int>&, const vector<int>&, vector<int>&, vector<int>&);
+typedef void (*StatsMatcher)(const vector<int>&, const vector<int>&, vector<int>&, vector<int>&, MatchStats&);
+
+struct Strategy
+{
+    string name;
+    Matcher match;
+    StatsMatcher matchWithStats;
+};
+
+const vector<Strategy> strategies = {
+    {"nested", processCards, processCards<MatchStats>},
+    {"hash", processCardsHash, processCardsHash<MatchStats>},
+    {"sorted", processCardsSorted, processCardsSorted<MatchStats>},
+};
+
 // Function to print the final cards of each player
 void finalCards(const vector<int>& cards)
 {
@@ -78,8 +311,312 @@ void winner(const vector<int>& a, const vector<int>& k)
     }
 }
 
-int main()
+// Benchmark
+// A generated deal: Ahmed's cards and Karim's cards
+struct Workload
+{
+    string name;
+    vector<int> N;
+    vector<int> M;
+};
+
+// Draw n cards from 1..k with Zipf(s) frequencies, so a few cards dominate the deal
+vector<int> zipfCards(size_t n, int k, double s, mt19937& rng)
+{
+    vector<double> weights(k);
+    for (int r = 0; r < k; ++r)
+    {
+        weights[r] = 1.0 / pow(r + 1, s);
+    }
+    discrete_distribution<int> pick(weights.begin(), weights.end());
+    vector<int> cards(n);
+    for (auto& card : cards)
+    {
+        card = pick(rng) + 1;
+    }
+    return cards;
+}
+
+vector<Workload> makeWorkloads(size_t n, unsigned seed)
+{
+    mt19937 rng(seed);
+    vector<Workload> workloads;
+
+    // Uniform random cards from a range as large as the deal
+    uniform_int_distribution<int> uniform(1, (int)n);
+    Workload random{"uniform", vector<int>(n), vector<int>(n)};
+    for (auto& card : random.N) card = uniform(rng);
+    for (auto& card : random.M) card = uniform(rng);
+    workloads.push_back(move(random));
+
+    // Every card is the same
+    workloads.push_back({"all-equal", vector<int>(n, 7), vector<int>(n, 7)});
+
+    // Both players hold a permutation of 1..n, so every card matches exactly once
+    Workload distinct{"all-distinct", vector<int>(n), vector<int>(n)};
+    for (size_t i = 0; i < n; ++i)
+    {
+        distinct.N[i] = distinct.M[i] = (int)i + 1;
+    }
+    shuffle(distinct.N.begin(), distinct.N.end(), rng);
+    shuffle(distinct.M.begin(), distinct.M.end(), rng);
+    workloads.push_back(move(distinct));
+
+    // Few cards dominate both hands
+    int range = max<int>(1, (int)n / 10);
+    workloads.push_back({"zipf", zipfCards(n, range, 1.1, rng), zipfCards(n, range, 1.1, rng)});
+
+    // Karim's hand starts with cards Ahmed never has, every match lands in the last half of M
+    Workload late{"adversarial-late", vector<int>(n), vector<int>(n)};
+    size_t half = n / 2;
+    for (size_t i = 0; i < n; ++i)
+    {
+        late.N[i] = (int)(i % (n - half)) + 1;
+    }
+    for (size_t j = 0; j < half; ++j)
+    {
+        late.M[j] = (int)(n + j) + 1;
+    }
+    for (size_t j = half; j < n; ++j)
+    {
+        late.M[j] = (int)(n - j);
+    }
+    workloads.push_back(move(late));
+
+    return workloads;
+}
+
+// Best time of one strategy on one workload, with what it dealt and the peak
+// resident set size of the process that ran it
+struct Timing
 {
+    double best = 1e300;
+    vector<int> Ahmed, Karim;
+    long peakRssKB = 0;
+};
+
+// Write or read exactly bytes through a pipe, false on error or early end
+bool writeAll(int fd, const void* data, size_t bytes)
+{
+    for (auto* p = static_cast<const char*>(data); bytes > 0;)
+    {
+        ssize_t n = write(fd, p, bytes);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+bool readAll(int fd, void* data, size_t bytes)
+{
+    for (auto* p = static_cast<char*>(data); bytes > 0;)
+    {
+        ssize_t n = read(fd, p, bytes);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+// Time strategy in a forked child and read the child's ru_maxrss, so the peak
+// RSS belongs to this run alone. In one process it is a high-water mark that
+// never goes down, and every row would show the largest strategy run so far.
+// The child sends the best time and both hands back through a pipe.
+bool timeInChild(const Strategy& strategy, const Workload& workload, int repeats, Timing& timing)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        cerr << "cannot create pipe: " << strerror(errno) << "\n";
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        cerr << "cannot fork: " << strerror(errno) << "\n";
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        for (int r = 0; r < repeats; ++r)
+        {
+            timing.Ahmed.clear();
+            timing.Karim.clear();
+            auto start = chrono::steady_clock::now();
+            strategy.match(workload.N, workload.M, timing.Ahmed, timing.Karim);
+            chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            timing.best = min(timing.best, elapsed.count());
+        }
+        bool sent = writeAll(fds[1], &timing.best, sizeof(timing.best));
+        for (const vector<int>* hand : {&timing.Ahmed, &timing.Karim})
+        {
+            size_t size = hand->size();
+            sent = sent && writeAll(fds[1], &size, sizeof(size))
+                   && writeAll(fds[1], hand->data(), size * sizeof(int));
+        }
+        _exit(sent ? 0 : 1);
+    }
+
+    close(fds[1]);
+    bool received = readAll(fds[0], &timing.best, sizeof(timing.best));
+    for (vector<int>* hand : {&timing.Ahmed, &timing.Karim})
+    {
+        size_t size = 0;
+        received = received && readAll(fds[0], &size, sizeof(size));
+        if (received)
+        {
+            hand->resize(size);
+            received = readAll(fds[0], hand->data(), size * sizeof(int));
+        }
+    }
+    close(fds[0]);
+
+    int status = 0;
+    rusage usage{};
+    while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR)
+    {
+    }
+    timing.peakRssKB = usage.ru_maxrss;
+    if (!received || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        cerr << strategy.name << " failed on " << workload.name << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Phase timings and allocations of one run, reported with --stats
+struct Phase
+{
+    string name;
+    double seconds;
+    size_t bytes;
+};
+
+void printStats(const string& matcher, const MatchStats& stats, const vector<Phase>& phases)
+{
+    cerr << "stats: matcher " << matcher << "\n"
+         << "  comparisons    " << stats.comparisons << "\n"
+         << "  hash probes    " << stats.probes << "\n"
+         << "  matches i<j    " << stats.ahmedWins << "\n"
+         << "  matches i>j    " << stats.karimKeeps << "\n"
+         << "  matches i==j   " << stats.samePlace << "\n";
+    for (const auto& phase : phases)
+    {
+        cerr << "  " << left << setw(8) << phase.name << right << fixed << setprecision(3)
+             << setw(10) << phase.seconds * 1000 << " ms " << setw(12) << phase.bytes << " bytes allocated\n";
+    }
+}
+
+// Time every strategy on every workload and check they agree with processCards.
+// Each strategy runs in its own child process, which the peakRSS column measures.
+int runBenchmark(size_t n, int repeats)
+{
+    cout << left << setw(18) << "workload" << setw(8) << "matcher"
+         << right << setw(12) << "ms" << setw(16) << "cards/sec" << setw(14) << "peakRSS(KB)" << "\n";
+
+    bool allAgree = true;
+    for (const auto& workload : makeWorkloads(n, 2025))
+    {
+        vector<int> expectedA, expectedK;
+        for (const auto& strategy : strategies)
+        {
+            Timing timing;
+            if (!timeInChild(strategy, workload, repeats, timing))
+            {
+                return 1;
+            }
+
+            // The first strategy is the original nested loop, everything else must match it
+            if (&strategy == &strategies.front())
+            {
+                expectedA = timing.Ahmed;
+                expectedK = timing.Karim;
+            }
+            else if (timing.Ahmed != expectedA || timing.Karim != expectedK)
+            {
+                cerr << strategy.name << " disagrees with " << strategies.front().name
+                     << " on " << workload.name << "\n";
+                allAgree = false;
+            }
+
+            double cards = (double)(workload.N.size() + workload.M.size());
+            cout << left << setw(18) << workload.name << setw(8) << strategy.name
+                 << right << fixed << setprecision(3) << setw(12) << timing.best * 1000
+                 << setprecision(0) << setw(16) << cards / max(timing.best, 1e-9)
+                 << setw(14) << timing.peakRssKB << "\n";
+        }
+    }
+    return allAgree ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    // "--bench [cards] [repeats]" times every matcher on generated deals instead of reading input
+    if (argc > 1 && string(argv[1]) == "--bench")
+    {
+        size_t n = argc > 2 ? stoul(argv[2]) : 5000;
+        int repeats = argc > 3 ? stoi(argv[3]) : 3;
+        return runBenchmark(max<size_t>(n, 2), max(repeats, 1));
+    }
+
+    // "--stats" prints counters and phase timings to stderr, "--matcher NAME" picks the matcher
+    bool withStats = false;
+    const Strategy* strategy = &strategies.front();
+    for (int a = 1; a < argc; ++a)
+    {
+        string arg = argv[a];
+        if (arg == "--stats")
+        {
+            withStats = true;
+        }
+        else if (arg == "--matcher" && a + 1 < argc)
+        {
+            string name = argv[++a];
+            auto found = find_if(strategies.begin(), strategies.end(),
+                                 [&name](const Strategy& s) { return s.name == name; });
+            if (found == strategies.end())
+            {
+                cerr << "unknown matcher: " << name << "\n";
+                return 1;
+            }
+            strategy = &*found;
+        }
+    }
+
+    MatchStats stats;
+    vector<Phase> phases;
+    auto phaseStart = chrono::steady_clock::now();
+    size_t phaseBytes = 0;
+    // Closes the current phase, only called with --stats
+    auto endPhase = [&](const string& name)
+    {
+        auto now = chrono::steady_clock::now();
+        phases.push_back({name, chrono::duration<double>(now - phaseStart).count(), allocatedBytes - phaseBytes});
+        phaseStart = chrono::steady_clock::now();
+        phaseBytes = allocatedBytes;
+    };
+    countAllocations = withStats;
+
     vector<int> N;  // Array to hold Ahmed's cards
     vector<int> M;  // Array to hold Karim's cards
     int card;
@@ -99,8 +636,21 @@ int main()
     vector<int> Ahmed_Final;  // Array to store Ahmed's final cards
     vector<int> Karim_Final;  // Array to store Karim's final cards
 
+    if (withStats)
+    {
+        endPhase("parse");
+    }
+
     // Process the cards to distribute them
-    processCards(N, M, Ahmed_Final, Karim_Final);
+    if (withStats)
+    {
+        strategy->matchWithStats(N, M, Ahmed_Final, Karim_Final, stats);
+        endPhase("match");
+    }
+    else
+    {
+        strategy->match(N, M, Ahmed_Final, Karim_Final);
+    }
 
     // Print Ahmed's final cards
     finalCards(Ahmed_Final);
@@ -111,5 +661,13 @@ int main()
     // Determine and print the winner
     winner(Ahmed_Final, Karim_Final);
 
+    if (withStats)
+    {
+        cout.flush();
+        endPhase("output");
+        countAllocations = false;
+        printStats(strategy->name, stats, phases);
+    }
+
     return 0;
 }
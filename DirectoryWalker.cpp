@@ -1,5 +1,19 @@
 #include <bits/stdc++.h>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <pwd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 using namespace std;
 
 // Flyweight
@@ -12,70 +26,502 @@ struct FileProperties
     string owner;
     string group; // File owner and group
 
+    uint32_t id = 0; // Dense index of this flyweight, in creation order
+    uint32_t extensionId = 0, ownerId = 0, groupId = 0; // Interned string ids
+    mutable atomic<uint64_t> uses{0}; // Files sharing this instance, counted only with factory stats on
+
     // Constructor initializes all properties
     FileProperties(string extension, bool readOnly, string owner, string group)
         : extension(move(extension)), readOnly(readOnly),
             owner(move(owner)), group(move(group)) {}
 };
 
+// IdTable: append-only table of pointers indexed by dense 32-bit ids.
+// Chunks are allocated once and never move, so get() needs no lock while other
+// threads append. Chunk k holds 2^(k + 10) ids, so a few dozen chunks cover
+// every 32-bit id and a small table stays small.
+template <class T>
+class IdTable
+{
+    static constexpr unsigned firstChunkBits = 10;
+    static constexpr uint64_t firstChunkSize = uint64_t(1) << firstChunkBits;
+    static constexpr unsigned maxChunks = 33 - firstChunkBits;
+
+    array<atomic<T**>, maxChunks> chunks{};
+    atomic<uint32_t> count{0};
+    mutex appendLock;
+
+    // Chunk of id and the position in it
+    static pair<unsigned, uint64_t> locate(uint32_t id)
+    {
+        uint64_t n = id + firstChunkSize;
+        unsigned chunk = bit_width(n) - 1 - firstChunkBits;
+        return {chunk, n - (firstChunkSize << chunk)};
+    }
+
+public:
+    ~IdTable()
+    {
+        for (auto& chunk : chunks)
+            delete[] chunk.load();
+    }
+
+    uint32_t append(T* value)
+    {
+        lock_guard<mutex> guard(appendLock);
+        uint32_t id = count.load(memory_order_relaxed);
+        if (id == numeric_limits<uint32_t>::max())
+            throw length_error("IdTable: too many ids");
+        auto [chunk, offset] = locate(id);
+        T** slots = chunks[chunk].load(memory_order_relaxed);
+        if (!slots) {
+            slots = new T*[firstChunkSize << chunk];
+            chunks[chunk].store(slots, memory_order_release);
+        }
+        slots[offset] = value;
+        count.store(id + 1, memory_order_release);
+        return id;
+    }
+
+    T* get(uint32_t id) const
+    {
+        auto [chunk, offset] = locate(id);
+        return chunks[chunk].load(memory_order_acquire)[offset];
+    }
+    uint32_t size() const { return count.load(memory_order_acquire); }
+};
+
+// StringPool: interns strings into dense 32-bit ids, safe to share between threads.
+// Strings are spread over lock-striped shards. A lookup takes a string_view, holds
+// its shard's lock in shared mode and does not allocate. Only a new string takes the
+// shard exclusively and is copied, once.
+class StringPool
+{
+    struct Hash
+    {
+        using is_transparent = void;
+        size_t operator()(string_view s) const noexcept { return hash<string_view>{}(s); }
+    };
+
+    struct Shard
+    {
+        shared_mutex lock;
+        unordered_map<string, uint32_t, Hash, equal_to<>> ids;
+    };
+
+    static constexpr size_t shardCount = 16;
+    array<Shard, shardCount> shards;
+    IdTable<const string> strings; // Id -> string, map keys never move
+
+public:
+    uint32_t intern(string_view s)
+    {
+        Shard& shard = shards[Hash{}(s) % shardCount];
+        {
+            shared_lock<shared_mutex> guard(shard.lock);
+            auto it = shard.ids.find(s);
+            if (it != shard.ids.end())
+                return it->second;
+        }
+        unique_lock<shared_mutex> guard(shard.lock);
+        auto [it, added] = shard.ids.try_emplace(string(s), 0);
+        if (added)
+            it->second = strings.append(&it->first);
+        return it->second;
+    }
+
+    const string& get(uint32_t id) const { return *strings.get(id); }
+    size_t size() const { return strings.size(); }
+
+    // Approximate memory held by the pool: map nodes, buckets, id table and string buffers
+    size_t bytesUsed() const;
+};
+
+// Heap bytes owned by a string, 0 while it fits in the small-string buffer
+size_t heapBytes(const string& s)
+{
+    auto* self = reinterpret_cast<const char*>(&s);
+    bool inline_ = s.data() >= self && s.data() < self + sizeof(s);
+    return inline_ ? 0 : s.capacity() + 1;
+}
+
+size_t StringPool::bytesUsed() const
+{
+    // A node holds the next pointer, the key, the id and the cached hash
+    const size_t nodeBytes = sizeof(void*) + sizeof(pair<const string, uint32_t>) + sizeof(size_t);
+    size_t bytes = sizeof(*this) + size() * sizeof(void*);
+    for (const auto& shard : shards)
+    {
+        bytes += shard.ids.size() * nodeBytes + shard.ids.bucket_count() * sizeof(void*);
+        for (const auto& [text, id] : shard.ids)
+            bytes += heapBytes(text);
+    }
+    return bytes;
+}
+
 // FilePropertiesFactory: implements the Flyweight pattern
 // It caches FileProperties objects so that identical property sets share one instance.
+// Extension, owner and group are interned into small ids, and a property set is
+// keyed by those ids packed into one 128-bit integer, so a hit costs three
+// string_view lookups and an integer lookup without allocating anything.
+// The cache is split into lock-striped shards with insert-once semantics, so the
+// walker threads can all intern properties at once. Hits only take a shard's lock
+// in shared mode.
 class FilePropertiesFactory
 {
-    // Key struct uniquely identifies a set of properties
-    struct Key
+    // Key layout: extension, owner and group ids in 32 bits each, readOnly above them.
+    // Every id fits, however many distinct strings there are.
+    using Key = unsigned __int128;
+
+    static Key pack(uint32_t extension, bool readOnly, uint32_t owner, uint32_t group)
     {
-        string extension;
-        bool readOnly;
-        string owner;
-        string group;
+        return (Key)extension | ((Key)owner << 32) | ((Key)group << 64) | ((Key)readOnly << 96);
+    }
 
-        bool operator == (const Key& k) const noexcept
-        {
-            return extension == k.extension
-                    && readOnly == k.readOnly
-                    && owner == k.owner
-                    && group==k.group;
-        }
-    };
-    // Hash functor for Key, so we can use it in an unordered_map
     struct KeyHash
     {
-        size_t operator()(const Key& k) const noexcept
+        size_t operator()(Key key) const noexcept
         {
-            size_t hFunctor = hash<string>{}(k.extension);
-            hFunctor = (hFunctor * 31) + hash<bool>{}(k.readOnly);
-            hFunctor = (hFunctor * 31) + hash<string>{}(k.owner);
-            hFunctor = (hFunctor * 31) + hash<string>{}(k.group);
-            return hFunctor;
+            uint64_t mixed = ((uint64_t)key ^ (uint64_t)(key >> 64) * 0x9E3779B97F4A7C15ull) * 0xC2B2AE3D27D4EB4Full;
+            return mixed ^ (mixed >> 29);
         }
     };
 
-    // Static cache mapping each Key to a shared FileProperties instance
-    static unordered_map<Key, shared_ptr<FileProperties>, KeyHash> cache;
+    struct alignas(64) Shard
+    {
+        shared_mutex lock;
+        // Cache mapping each packed key to a shared FileProperties instance
+        unordered_map<Key, shared_ptr<FileProperties>, KeyHash> cache;
+        atomic<uint64_t> hits, misses; // Counted only with stats on, zero from the start
+    };
+
+    static constexpr size_t shardCount = 64;
+    static inline array<Shard, shardCount> shards;
+    static inline StringPool extensions, owners, groups;
+    static inline IdTable<FileProperties> byId;
+    static inline bool statsEnabled = false;
+
+    static Shard& shardOf(Key key) { return shards[KeyHash{}(key) >> 58]; }
 
 public:
+    // Returns the cached shared pointer for the inputs, creating it on first use.
+    // The reference stays valid forever and hits touch no reference count.
+    static const shared_ptr<FileProperties>& intern(string_view extension, bool readOnly,
+                                                    string_view owner, string_view group)
+    {
+        uint32_t extensionId = extensions.intern(extension);
+        uint32_t ownerId = owners.intern(owner);
+        uint32_t groupId = groups.intern(group);
+        Key key = pack(extensionId, readOnly, ownerId, groupId);
+
+        Shard& shard = shardOf(key);
+        {
+            shared_lock<shared_mutex> guard(shard.lock);
+            auto it = shard.cache.find(key);
+            if (it != shard.cache.end()) {
+                if (statsEnabled) {
+                    shard.hits.fetch_add(1, memory_order_relaxed);
+                    it->second->uses.fetch_add(1, memory_order_relaxed);
+                }
+                return it->second;
+            }
+        }
+        // Not found, create a new FileProperties unless another thread just did
+        unique_lock<shared_mutex> guard(shard.lock);
+        auto [it, added] = shard.cache.try_emplace(key);
+        if (added) {
+            auto fileProperties = make_shared<FileProperties>(string(extension), readOnly, string(owner), string(group));
+            fileProperties->extensionId = extensionId;
+            fileProperties->ownerId = ownerId;
+            fileProperties->groupId = groupId;
+            fileProperties->id = byId.append(fileProperties.get());
+            it->second = move(fileProperties);
+        }
+        if (statsEnabled) {
+            (added ? shard.misses : shard.hits).fetch_add(1, memory_order_relaxed);
+            it->second->uses.fetch_add(1, memory_order_relaxed);
+        }
+        return it->second;
+    }
+
     // Returns a shared pointer to a FileProperties object matching the inputs.
     // If it doesn't exist yet, create and cache it.
-    static shared_ptr<FileProperties> get(const string& extension, bool readOnly,
-                                          const string& owner, const string& group)
+    static shared_ptr<FileProperties> get(string_view extension, bool readOnly,
+                                          string_view owner, string_view group)
     {
-        Key key{extension, readOnly, owner, group};
-        auto it = cache.find(key);
-        if(it!=cache.end())
-            return it->second;
-        // Not found, create a new FileProperties and store it
-        auto fileProperties = make_shared<FileProperties>(extension, readOnly, owner,group);
-        cache.emplace(move(key),fileProperties);
-        return fileProperties;
+        return intern(extension, readOnly, owner, group);
+    }
+
+    // Every flyweight created so far, indexed by FileProperties::id
+    static size_t size() { return byId.size(); }
+    static const FileProperties& get(uint32_t id) { return *byId.get(id); }
+
+    // The interned strings, indexed by the ids stored in FileProperties
+    static const StringPool& extensionPool() { return extensions; }
+    static const StringPool& ownerPool() { return owners; }
+    static const StringPool& groupPool() { return groups; }
+
+    // Count hits, misses and uses per flyweight from now on. Call before ingestion starts.
+    static void enableStats() { statsEnabled = true; }
+
+    // Write a JSON summary of the cache. "bytes_without_sharing" is what one
+    // FileProperties per file would take, "bytes_used" is the flyweights plus the
+    // cache and string pools that make sharing possible. Byte counts are estimates
+    // from object and node sizes, not allocator measurements.
+    static void writeStats(ostream& out)
+    {
+        uint64_t hits = 0, misses = 0;
+        size_t buckets = 0, entries = 0, longest = 0;
+        array<size_t, 5> chains{}; // Buckets holding 0, 1, 2, 3 and 4+ entries
+        size_t bytesUsed = 0, bytesWithoutSharing = 0;
+
+        // A cache node holds the next pointer, the key and the shared_ptr
+        const size_t nodeBytes = sizeof(void*) + sizeof(pair<const Key, shared_ptr<FileProperties>>);
+        // make_shared puts the reference counts next to the object
+        const size_t controlBytes = 2 * sizeof(long) + sizeof(void*);
+        for (auto& shard : shards)
+        {
+            shared_lock<shared_mutex> guard(shard.lock);
+            hits += shard.hits.load(memory_order_relaxed);
+            misses += shard.misses.load(memory_order_relaxed);
+            buckets += shard.cache.bucket_count();
+            entries += shard.cache.size();
+            bytesUsed += shard.cache.size() * nodeBytes + shard.cache.bucket_count() * sizeof(void*);
+            for (size_t b = 0; b < shard.cache.bucket_count(); ++b)
+            {
+                size_t chain = shard.cache.bucket_size(b);
+                ++chains[min<size_t>(chain, 4)];
+                longest = max(longest, chain);
+            }
+            for (const auto& [key, props] : shard.cache)
+            {
+                size_t objectBytes = sizeof(FileProperties) + heapBytes(props->extension)
+                                     + heapBytes(props->owner) + heapBytes(props->group);
+                bytesUsed += objectBytes + controlBytes;
+                bytesWithoutSharing += objectBytes * props->uses.load(memory_order_relaxed);
+            }
+        }
+        bytesUsed += sizeof(shards) + size() * sizeof(void*)
+                     + extensions.bytesUsed() + owners.bytesUsed() + groups.bytesUsed();
+
+        out << "{\"lookups\": " << hits + misses
+            << ", \"hits\": " << hits
+            << ", \"misses\": " << misses
+            << ", \"distinct\": " << size()
+            << ", \"strings\": {\"extensions\": " << extensions.size()
+            << ", \"owners\": " << owners.size() << ", \"groups\": " << groups.size() << "}"
+            << ", \"bytes_without_sharing\": " << bytesWithoutSharing
+            << ", \"bytes_used\": " << bytesUsed
+            << ", \"buckets\": {\"shards\": " << shardCount << ", \"count\": " << buckets
+            << ", \"load_factor\": " << fixed << setprecision(3) << (buckets ? (double)entries / buckets : 0.0)
+            << ", \"longest_chain\": " << longest
+            << ", \"chains\": {\"0\": " << chains[0] << ", \"1\": " << chains[1] << ", \"2\": " << chains[2]
+            << ", \"3\": " << chains[3] << ", \"4+\": " << chains[4] << "}}}\n";
+    }
+};
+
+// Extension of a file name: what follows the last '.', empty if there is none
+string_view extensionOf(string_view nameExtension)
+{
+    auto position = nameExtension.find_last_of('.');
+    return position == string_view::npos ? string_view() : nameExtension.substr(position + 1);
+}
+
+// SizeSum: exact accumulator for sizes in KB
+// Every finite double is an integer multiple of 2^-1074, so a sum of doubles is
+// one too. SizeSum keeps that integer exactly, as 32-bit digits held in 64-bit
+// limbs, and only over the range of magnitudes it has seen (a few limbs for
+// real sizes). Nothing is rounded until value(), and integer addition is
+// associative, so every order of adding (serial, parallel, incremental) gives
+// bit-for-bit the same total, and no size is too small or too large to count.
+class SizeSum
+{
+    static constexpr int digitBits = 32;
+    static constexpr int64_t digitMask = (int64_t(1) << digitBits) - 1;
+    static constexpr int inlineLimbs = 8; // Enough for sizes from bytes to petabytes
+
+    // limbs()[i] counts units of 2^(32 * (first + i) - 1074). They live in small
+    // until the range of magnitudes outgrows it, then in large.
+    array<int64_t, inlineLimbs> small{};
+    vector<int64_t> large;
+    int first = 0, count = 0;
+    double special = 0; // Sum of infinite and NaN inputs, which have no exact form
+
+    int64_t* limbs() { return large.empty() ? small.data() : large.data(); }
+    const int64_t* limbs() const { return large.empty() ? small.data() : large.data(); }
+
+    // Make the limbs cover digits [low, high), new ones 0
+    void cover(int low, int high)
+    {
+        if (count == 0)
+            first = low;
+        int newFirst = min(first, low), newCount = max(first + count, high) - newFirst;
+        if (newCount <= inlineLimbs) {
+            memmove(small.data() + (first - newFirst), small.data(), count * sizeof(int64_t));
+            fill_n(small.data(), first - newFirst, 0);
+        } else {
+            vector<int64_t> grown(newCount, 0);
+            copy_n(limbs(), count, grown.begin() + (first - newFirst));
+            large = move(grown);
+        }
+        first = newFirst;
+        count = newCount;
+    }
+
+    // Limbs up to the highest one that is not 0
+    int significantLimbs() const
+    {
+        int top = count;
+        while (top > 0 && limbs()[top - 1] == 0)
+            --top;
+        return top;
+    }
+
+    // Carry every limb into a digit, the top limb keeps the sign
+    void normalize()
+    {
+        for (int i = 0; i + 1 < count; ++i)
+        {
+            int64_t* at = limbs();
+            int64_t carry = at[i] >> digitBits;
+            at[i] &= digitMask;
+            at[i + 1] += carry;
+        }
+        while (count != 0 && (limbs()[count - 1] > digitMask || limbs()[count - 1] < -digitMask))
+        {
+            cover(first, first + count + 1);
+            int64_t* at = limbs();
+            at[count - 1] = at[count - 2] >> digitBits;
+            at[count - 2] &= digitMask;
+        }
+    }
+
+public:
+    void add(double sizeKB)
+    {
+        uint64_t bits = bit_cast<uint64_t>(sizeKB);
+        unsigned biased = (bits >> 52) & 0x7ff;
+        uint64_t mantissa = bits & ((uint64_t(1) << 52) - 1);
+        if (biased == 0x7ff) {
+            special += sizeKB;
+            return;
+        }
+        if (biased != 0)
+            mantissa |= uint64_t(1) << 52;
+        else if (mantissa == 0)
+            return;
+
+        // sizeKB is mantissa * 2^(exponent - 1074); subnormals share the exponent
+        // of the smallest normal, without the implicit bit. The 53-bit mantissa,
+        // shifted within its first digit, spans three digits.
+        unsigned exponent = max(biased, 1u) - 1;
+        int digit = (int)(exponent / digitBits);
+        unsigned shift = exponent % digitBits;
+        if (digit < first || digit + 3 > first + count)
+            cover(digit, digit + 4); // One spare digit for carries
+        uint64_t low = mantissa << shift;
+        uint64_t high = shift ? mantissa >> (64 - shift) : 0;
+        int64_t sign = bits >> 63 ? -1 : 1;
+        int64_t* at = limbs() + (digit - first);
+        at[0] += sign * (int64_t)(low & digitMask);
+        at[1] += sign * (int64_t)(low >> digitBits);
+        at[2] += sign * (int64_t)high;
+        // Carry once a limb leaves (-2^62, 2^62), long before it could overflow
+        constexpr uint64_t bias = uint64_t(1) << 62;
+        if (((at[0] + bias) | (at[1] + bias) | (at[2] + bias)) >> 63)
+            normalize();
+    }
+
+    void add(const SizeSum& other) { merge(other, 1); }
+    void subtract(const SizeSum& other) { merge(other, -1); }
+
+    // The exact sum rounded once, to nearest with ties to even
+    double value() const
+    {
+        SizeSum sum = *this;
+        sum.normalize();
+        int top = sum.significantLimbs();
+        if (top == 0)
+            return special;
+        bool negative = sum.limbs()[top - 1] < 0;
+        if (negative) {
+            for (int i = 0; i < sum.count; ++i)
+                sum.limbs()[i] = -sum.limbs()[i];
+            sum.normalize();
+            top = sum.significantLimbs();
+        }
+
+        // Every digit is now in [0, 2^32). The three top ones hold the leading
+        // one and at least 64 bits below it; anything lower only sets sticky.
+        const int64_t* at = sum.limbs();
+        int low = max(top - 3, 0);
+        unsigned __int128 window = 0;
+        for (int i = top; i-- > low;)
+            window = window << digitBits | (uint64_t)at[i];
+        bool sticky = any_of(at, at + low, [](int64_t digit) { return digit != 0; });
+        int lead = digitBits * (top - 1) + bit_width((uint64_t)at[top - 1]) - 1;
+
+        // Keep 53 bits. Fewer are exact: the smallest digit already is 2^-1074.
+        int shift = max(lead - 52 - digitBits * low, 0);
+        uint64_t kept = (uint64_t)(window >> shift);
+        if (shift > 0) {
+            unsigned __int128 rest = window & (((unsigned __int128)1 << shift) - 1);
+            unsigned __int128 half = (unsigned __int128)1 << (shift - 1);
+            if (rest > half || (rest == half && (sticky || (kept & 1))))
+                ++kept;
+        }
+        double magnitude = ldexp((double)kept, digitBits * (sum.first + low) + shift - 1074);
+        return (negative ? -magnitude : magnitude) + special;
+    }
+
+private:
+    void merge(const SizeSum& other, int sign)
+    {
+        special += sign * other.special;
+        if (other.count == 0)
+            return;
+        SizeSum digits = other;
+        digits.normalize();
+        if (digits.first < first || digits.first + digits.count + 1 > first + count)
+            cover(digits.first, digits.first + digits.count + 1);
+        int64_t* at = limbs() + (digits.first - first);
+        for (int i = 0; i < digits.count; ++i)
+            at[i] += sign * digits.limbs()[i];
+        normalize();
     }
 };
 
-// Define the static cache instance
-unordered_map<FilePropertiesFactory::Key,
-              shared_ptr<FileProperties>,
-              FilePropertiesFactory::KeyHash>
-    FilePropertiesFactory::cache;
+// BufferedSizeSum: SizeSum for a loop over scattered nodes
+// Sizes are queued and added in batches. Interleaved with the loop, the digit
+// arithmetic would hold back the cache misses of the next nodes.
+class BufferedSizeSum
+{
+    SizeSum sum;
+    array<double, 64> queue;
+    size_t queued = 0;
+
+public:
+    void add(double sizeKB)
+    {
+        queue[queued++] = sizeKB;
+        if (queued == queue.size())
+            flush();
+    }
+    void flush()
+    {
+        for (size_t i = 0; i < queued; ++i)
+            sum.add(queue[i]);
+        queued = 0;
+    }
+    SizeSum get() const
+    {
+        SizeSum result = sum;
+        for (size_t i = 0; i < queued; ++i)
+            result.add(queue[i]);
+        return result;
+    }
+    double value() const { return get().value(); }
+};
 
 // Visitor interface declares operations for File and Directory nodes.
 class File;
@@ -88,14 +534,23 @@ struct Visitor
     virtual ~Visitor() = default;
 };
 
+// Tag stored in every node, so traversals can dispatch without virtual calls
+enum class NodeKind : uint8_t { File, Directory };
+
 // Node: common base for File and Directory
 class Node : public enable_shared_from_this<Node>
 {
+    friend class Directory;
+
 protected:
     string name; // Name of the file or directory
+    Directory* parent = nullptr; // Owning directory, set by Directory::addChild
+    NodeKind nodeKind;
+    bool regular = true; // Files only: false for a walked symlink, device, FIFO or socket
+    uint32_t position = 0; // Index in the parent's children, for O(1) removal
 
 public:
-    explicit Node(string name):name(move(name)){}
+    Node(string name, NodeKind kind):name(move(name)), nodeKind(kind){}
 
     // Accept a visitor
     virtual void accept(Visitor& visitor) = 0;
@@ -103,21 +558,30 @@ public:
     virtual bool isDirectory() const =0;
     // Get the node's name
     const string& getName() const { return name; }
+    // Rename; a node held by a PathIndex must be taken out of it first
+    void setName(string newName) { name = move(newName); }
+    Directory* getParent() const { return parent; }
+    NodeKind kind() const { return nodeKind; }
     virtual ~Node() = default;
 };
 
 // File: terminal node that stores its size and a pointer to shared FileProperties
 class File : public Node
 {
+    friend class Directory;
+
     double sizeKB; // File size in KB
     shared_ptr<FileProperties> props; // Shared file metadata
 
 public:
-    File(string name,double size,shared_ptr<FileProperties> properties)
-        : Node(move(name)), sizeKB(size), props(move(properties)) {}
+    File(string name,double size,shared_ptr<FileProperties> properties, bool regular = true)
+        : Node(move(name), NodeKind::File), sizeKB(size), props(move(properties)) { this->regular = regular; }
 
     double getSize() const { return sizeKB; }
-    shared_ptr<FileProperties> getProps() const { return props; }
+    // Whether the file is a regular one, only a walk can tell otherwise
+    bool isRegular() const { return regular; }
+    const shared_ptr<FileProperties>& getProps() const { return props; }
+    void setProps(shared_ptr<FileProperties> properties) { props = move(properties); }
 
     // Accept a visitor: let it process this File
     void accept(Visitor& visitor) override { visitor.visit(*this); }
@@ -125,176 +589,3975 @@ public:
 };
 
 // Iterator interface for traversing Nodes
+// next() hands out plain pointers: the tree owns its nodes, so iterating costs no refcounts
 class Iterator
 {
 public:
     virtual bool hasNext() = 0;
-    virtual shared_ptr<Node> next() = 0;
+    virtual Node* next() = 0;
     virtual ~Iterator() = default;
 };
 
 class Directory; // Forward declaration
 
-// DirectoryIterator: depth-first traversal over a directory tree
+// DirectoryIterator: lazy depth-first traversal over a directory tree
+// It yields every node below the root, in the same order as Directory::accept
+// (the root itself is not included). The stack only grows with depth, so steps
+// do not allocate. Besides the Iterator interface it is a C++20 input iterator
+// ending at default_sentinel, see Directory::descendants().
 class DirectoryIterator : public Iterator
 {
-    // Stack holds pairs of (directory ptr, next child index)
-    vector<pair<shared_ptr<Directory>,size_t>> stk;
+    // Stack holds pairs of (directory ptr, next child index), every top entry
+    // points at an existing child, so the next node is always stk.back()
+    vector<pair<const Directory*,size_t>> stk;
+
+    Node* peek() const;
+    void advance();
+    void skipFinished();
 
 public:
-    explicit DirectoryIterator(shared_ptr<Directory> root);
-    bool hasNext() override;
-    shared_ptr<Node> next() override;
+    using value_type = Node;
+    using difference_type = ptrdiff_t;
+
+    DirectoryIterator() = default;
+    explicit DirectoryIterator(const Directory& root);
+    bool hasNext() override { return !stk.empty(); }
+    Node* next() override;
+
+    Node& operator*() const { return *peek(); }
+    Node* operator->() const { return peek(); }
+    DirectoryIterator& operator++() { advance(); return *this; }
+    void operator++(int) { advance(); }
+    bool operator==(default_sentinel_t) const { return stk.empty(); }
 };
 
 // Directory: node that contains children (files or subdirectories)
+// Every directory caches the total size and file count of its subtree. addChild
+// adds the child's contribution to this directory and each ancestor, so reading a
+// total is O(1) and adding a node is O(depth). Both sit behind a small spinlock,
+// because the filesystem walker fills sibling subtrees from several threads; the
+// file count is also atomic, so reading it takes no lock.
+// removeChild and setFileSize update the same aggregates in O(depth). Removal is
+// O(1): every node knows its position, and the last child moves into the gap.
 class Directory : public Node
 {
     vector<shared_ptr<Node>> children;  // List of child nodes
+    mutable atomic_flag totalLock;
+    atomic<size_t> fileCount{0};        // Files in the subtree, written under totalLock
+    SizeSum total;                      // Subtree size, guarded by totalLock
+
+    void lockTotal() const
+    {
+        while (totalLock.test_and_set(memory_order_acquire))
+            this_thread::yield();
+    }
+    void unlockTotal() const { totalLock.clear(memory_order_release); }
+
+    // Add a size and file count delta to this directory and all its ancestors.
+    // size is a double or a SizeSum, sign 1 adds it and -1 takes it away.
+    template <class Size>
+    void propagate(const Size& size, long long files, int sign)
+    {
+        for (Directory* dir = this; dir; dir = dir->parent)
+        {
+            dir->lockTotal();
+            if constexpr (is_same_v<Size, double>)
+                dir->total.add(sign * size);
+            else if (sign > 0)
+                dir->total.add(size);
+            else
+                dir->total.subtract(size);
+            dir->fileCount.store(dir->fileCount.load(memory_order_relaxed) + sign * files, memory_order_relaxed);
+            dir->unlockTotal();
+        }
+    }
+
+    // Add (sign 1) or take away (sign -1) what node contributes to its ancestors
+    void propagateNode(const Node& node, int sign)
+    {
+        if (node.kind() == NodeKind::File) {
+            propagate(static_cast<const File&>(node).getSize(), 1, sign);
+            return;
+        }
+        auto& dir = static_cast<const Directory&>(node);
+        long long files = (long long)dir.fileCount.load(memory_order_relaxed);
+        if (files != 0)
+            propagate(dir.getSizeSum(), files, sign);
+    }
 
 public:
-    explicit Directory(string name) : Node(move(name)) {}
+    explicit Directory(string name) : Node(move(name), NodeKind::Directory) {}
 
     // Add a child node (file or directory)
-    void addChild(shared_ptr<Node> name) { children.emplace_back(move(name)); }
+    void addChild(shared_ptr<Node> name)
+    {
+        name->parent = this;
+        name->position = (uint32_t)children.size();
+        children.emplace_back(move(name));
+        propagateNode(*children.back(), 1);
+    }
+
+    // Add several children in order. Their sizes and file counts are summed here
+    // and reach the ancestors in one update, instead of one per child.
+    void addChildren(vector<shared_ptr<Node>> nodes)
+    {
+        SizeSum size;
+        long long files = 0;
+        children.reserve(children.size() + nodes.size());
+        for (auto& node : nodes)
+        {
+            node->parent = this;
+            node->position = (uint32_t)children.size();
+            if (node->kind() == NodeKind::File) {
+                size.add(static_cast<const File&>(*node).getSize());
+                ++files;
+            } else if (auto& dir = static_cast<const Directory&>(*node); dir.getFileCount() != 0) {
+                size.add(dir.getSizeSum());
+                files += (long long)dir.getFileCount();
+            }
+            children.push_back(move(node));
+        }
+        if (files != 0)
+            propagate(size, files, 1);
+    }
+
+    // Detach a child of this directory and hand back ownership. The last child
+    // takes its place, so sibling order is only kept up to that swap.
+    shared_ptr<Node> removeChild(Node& child)
+    {
+        uint32_t i = child.position;
+        shared_ptr<Node> removed = move(children[i]);
+        if (i + 1 != children.size()) {
+            children[i] = move(children.back());
+            children[i]->position = i;
+        }
+        children.pop_back();
+        propagateNode(*removed, -1);
+        removed->parent = nullptr;
+        return removed;
+    }
+
+    // Change the size of a file in this directory, adjusting every ancestor's total
+    void setFileSize(File& file, double sizeKB)
+    {
+        SizeSum delta;
+        delta.add(sizeKB);
+        delta.add(-file.sizeKB);
+        file.sizeKB = sizeKB;
+        propagate(delta, 0, 1);
+    }
     const vector<shared_ptr<Node>>& getChildren() const { return children; }
 
+    // Cached subtree aggregates
+    SizeSum getSizeSum() const
+    {
+        lockTotal();
+        SizeSum sum = total;
+        unlockTotal();
+        return sum;
+    }
+    double getTotal() const { return getSizeSum().value(); }
+    size_t getFileCount() const { return fileCount.load(memory_order_relaxed); }
+
     // Factory method to get an iterator for this directory
-    unique_ptr<Iterator> createIterator()
+    unique_ptr<Iterator> createIterator() const
+    {
+        return make_unique<DirectoryIterator>(*this);
+    }
+
+    // Every node below this directory as a range, e.g. for (Node& node : dir.descendants())
+    ranges::subrange<DirectoryIterator, default_sentinel_t> descendants() const
     {
-        // Use shared_from_this to get a shared_ptr<Directory> for this
-        return make_unique<DirectoryIterator>(
-            static_pointer_cast<Directory>(shared_from_this()));
+        return {DirectoryIterator(*this), default_sentinel};
+    }
+
+    // Preorder walk below top: onDirectory(top) first, then every descendant in
+    // insertion order. It keeps an explicit stack on the heap instead of recursing,
+    // so arbitrarily deep DIR chains cannot overflow the call stack.
+    template <class OnFile, class OnDirectory>
+    static void preorder(Directory& top, OnFile&& onFile, OnDirectory&& onDirectory)
+    {
+        onDirectory(top);
+        vector<pair<Directory*, size_t>> stack{{&top, 0}}; // (directory, next child)
+        while (!stack.empty())
+        {
+            auto& [dir, next] = stack.back();
+            if (next == dir->children.size()) {
+                stack.pop_back();
+                continue;
+            }
+            Node& child = *dir->children[next++];
+            if (child.kind() == NodeKind::File) {
+                onFile(static_cast<File&>(child));
+            } else {
+                auto& sub = static_cast<Directory&>(child);
+                onDirectory(sub);
+                stack.push_back({&sub, 0});
+            }
+        }
     }
 
     // Accept a visitor: first visit this directory, then its children
     void accept(Visitor& visitor) override
     {
-        visitor.visit(*this);
-        for (auto& children : children) children->accept(visitor);
+        preorder(*this, [&visitor](File& file) { file.accept(visitor); },
+                 [&visitor](Directory& dir) { visitor.visit(dir); });
     }
     bool isDirectory() const override { return true; }
+
+    // Release the subtree iteratively: a directory that is about to die hands its
+    // children to this loop first, so destroying a deep chain does not recurse
+    ~Directory() override
+    {
+        vector<shared_ptr<Node>> pending = move(children);
+        while (!pending.empty())
+        {
+            shared_ptr<Node> node = move(pending.back());
+            pending.pop_back();
+            if (node.use_count() == 1 && node->kind() == NodeKind::Directory) {
+                auto& grandchildren = static_cast<Directory&>(*node).children;
+                move(grandchildren.begin(), grandchildren.end(), back_inserter(pending));
+                grandchildren.clear();
+            }
+        }
+    }
 };
 
+static_assert(input_iterator<DirectoryIterator> && sentinel_for<default_sentinel_t, DirectoryIterator>);
+
+inline DirectoryIterator::DirectoryIterator(const Directory& root)
+{
+    stk.emplace_back(&root, 0);
+    skipFinished();
+}
+
+inline Node* DirectoryIterator::peek() const
+{
+    auto [dir, index] = stk.back();
+    return dir->getChildren()[index].get();
+}
+
+// Drop directories whose children have all been returned
+inline void DirectoryIterator::skipFinished()
+{
+    while (!stk.empty() && stk.back().second == stk.back().first->getChildren().size())
+    {
+        stk.pop_back();
+    }
+}
+
+inline void DirectoryIterator::advance()
+{
+    Node* node = peek();
+    ++stk.back().second;
+    if (node->kind() == NodeKind::Directory) {
+        auto* dir = static_cast<const Directory*>(node);
+        if (!dir->getChildren().empty()) {
+            stk.emplace_back(dir, 0);
+            return;
+        }
+    }
+    skipFinished();
+}
+
+inline Node* DirectoryIterator::next()
+{
+    Node* node = peek();
+    advance();
+    return node;
+}
+
+// Views of FlatTree and FrozenTree nodes, defined with those trees below
+struct FlatFile;
+struct FlatDirectory;
+struct FrozenFile;
+struct FrozenDirectory;
+
 // SizeVisitor: implements Visitor to sum up file sizes in a subtree
-class SizeVisitor : public Visitor
+// It is final, so traverse() below can call its visit() methods directly.
+class SizeVisitor final : public Visitor
 {
-    double total = 0.0;  // Running total of sizes
+    BufferedSizeSum total;  // Running total of sizes
 
 public:
     // When visiting a File, add its size
-    void visit(File& file) override { total += file.getSize(); }
+    void visit(File& file) override { total.add(file.getSize()); }
     // Directories don't contribute directly
     void visit(Directory&) override {}
-    double getTotal() const { return total; }
+    // The same for FlatTree and FrozenTree nodes
+    void visit(const FlatFile& file);
+    void visit(const FlatDirectory&) {}
+    void visit(const FrozenFile& file);
+    void visit(const FrozenDirectory&) {}
+    double getTotal() const { return total.value(); }
 };
 
+// Static dispatch
+// traverse() visits in the same order as Directory::accept, but picks File or
+// Directory from the node's kind tag instead of calling virtual accept(). For a
+// final visitor class, visit() then resolves at compile time and inlines into
+// the loop. Any Visitor works with both accept() and traverse().
+template <class V>
+void traverse(Node& node, V& visitor)
+{
+    if (node.kind() == NodeKind::File) {
+        visitor.visit(static_cast<File&>(node));
+        return;
+    }
+    Directory::preorder(static_cast<Directory&>(node), [&visitor](File& file) { visitor.visit(file); },
+                        [&visitor](Directory& dir) { visitor.visit(dir); });
+}
+
 // Formatting helpers
-// Convert a size in KB to a string, with no decimals if integer, else one decimal
-string sizeStr(double size)
+// Longest text formatSize can produce
+constexpr size_t maxSizeChars = 400;
+
+// Write a size in KB with no decimals if integer, else one decimal, followed by "KB".
+// out needs maxSizeChars bytes, the end of the written text is returned.
+char* formatSize(char* out, double size)
 {
-    stringstream stringS;
+    char* end = out + maxSizeChars - 2;
     if(fabs(size - round(size)) < 1e-6)
-        stringS << (long long)round(size);
+        out = to_chars(out, end, (long long)round(size)).ptr;
     else
-        stringS << fixed << setprecision(1) << size;
-    return stringS.str() + "KB";
+        out = to_chars(out, end, size, chars_format::fixed, 1).ptr;
+    *out++ = 'K';
+    *out++ = 'B';
+    return out;
 }
 
-// Recursively print the directory tree in a Linux-style format
-void printTree(const shared_ptr<Node>& node,
-               const string& prefix, bool last)
+// Convert a size in KB to a string, with no decimals if integer, else one decimal
+string sizeStr(double size)
 {
-    if (node->isDirectory()) {
-        if (prefix.empty())
-            cout << ".\n"; // Root
-
-        auto* dir = static_cast<Directory*>(node.get());
-        const auto& children = dir->getChildren();
-        for (size_t i = 0; i < children.size(); ++i)
-        {
-            bool isLast = (i == children.size() - 1);
-            cout << prefix << (isLast ? "└── " : "├── ")
-                 << children[i]->getName();
-            if (!children[i]->isDirectory()) {
-                auto* f = static_cast<File*>(children[i].get());
-                cout << " (" << sizeStr(f->getSize()) << ")";
-            }
-            cout << "\n";
-            if (children[i]->isDirectory()) {
-                // Indent for children
-                printTree(children[i], prefix + (isLast ? "    " : "│   "), isLast);
-            }
-        }
-    }
+    char text[maxSizeChars];
+    return string(text, formatSize(text, size));
 }
 
-int main()
+// Arena-backed flat tree
+// An alternative to the shared_ptr tree for very large inputs. Nodes live in
+// chunked arena pools and refer to each other by 32-bit indices, names are packed
+// into a character arena, and files point at their flyweight properties without
+// owning them. Nothing is reference counted and nothing is freed node by node.
+
+// IndexArena: append-only pool of T addressed by 32-bit indices.
+// It grows in chunks of 2^ChunkBits elements, so elements never move.
+template <class T, unsigned ChunkBits = 16>
+class IndexArena
 {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
+    static constexpr uint32_t chunkSize = 1u << ChunkBits;
+    vector<unique_ptr<T[]>> chunks;
+    uint32_t count = 0;
 
-    size_t N;
-    if (!(cin >> N))
-        return 0;
+public:
+    uint32_t size() const { return count; }
 
-    // Map from directory ID to Directory pointer, root is ID 0
-    unordered_map<long long, shared_ptr<Directory>> dirs;
-    auto root = make_shared<Directory>(""); // Root has empty name
-    dirs[0] = root;
+    // Reserve n consecutive elements inside one chunk, return the index of the first
+    uint32_t allocate(uint32_t n = 1)
+    {
+        if (n > chunkSize)
+            throw length_error("IndexArena: block larger than a chunk");
+        uint32_t offset = count & (chunkSize - 1);
+        if (chunks.empty() || (offset != 0 && offset + n > chunkSize))
+            count = (uint32_t)chunks.size() << ChunkBits; // Skip to a fresh chunk
+        if ((count >> ChunkBits) == chunks.size())
+            chunks.push_back(make_unique<T[]>(chunkSize));
+        uint32_t first = count;
+        count += n;
+        return first;
+    }
 
-    string operation;
+    T& operator[](uint32_t i) { return chunks[i >> ChunkBits][i & (chunkSize - 1)]; }
+    const T& operator[](uint32_t i) const { return chunks[i >> ChunkBits][i & (chunkSize - 1)]; }
+};
 
-    for (size_t i = 0; i < N; ++i)
-    {
-        cin >> operation;
-        if (operation == "DIR") {
-            long long id;
-            string name;
-            string maybeParent;
+// FlatNode: one file or directory of a FlatTree
+struct FlatNode
+{
+    static constexpr uint32_t none = UINT32_MAX;
 
-            cin >> id;
+    uint32_t name = 0;             // First character of the name in the name arena
+    uint32_t nameLength = 0;
+    uint32_t parent = none;
+    uint32_t firstChild = none;    // Directories only
+    uint32_t lastChild = none;     // Directories only, for O(1) appends
+    uint32_t nextSibling = none;
+    bool directory = false;
+    double sizeKB = 0;             // Files only
+    const FileProperties* props = nullptr; // Files only, owned by FilePropertiesFactory
+};
 
-            getline(cin, maybeParent); // Read rest of line
+class FlatTree
+{
+    IndexArena<FlatNode> nodes;
+    IndexArena<char, 20> names;
 
-            stringstream stringS(maybeParent);
-            long long parentId = 0;
+    uint32_t addNode(uint32_t parent, string_view name)
+    {
+        uint32_t index = nodes.allocate();
+        FlatNode& node = nodes[index];
+        node.name = names.allocate((uint32_t)max<size_t>(name.size(), 1));
+        node.nameLength = (uint32_t)name.size();
+        copy(name.begin(), name.end(), &names[node.name]);
+        node.parent = parent;
 
-            if (!(stringS >> name)) continue; // Skip if no name
-                string remain;
-            if (stringS >> remain) { // If parent ID was provided
-                parentId = stoll(name);
-                name = remain;
-            }
+        if (parent != FlatNode::none) {
+            FlatNode& dir = nodes[parent];
+            if (dir.lastChild == FlatNode::none)
+                dir.firstChild = index;
+            else
+                nodes[dir.lastChild].nextSibling = index;
+            dir.lastChild = index;
+        }
+        return index;
+    }
 
-            auto dir = make_shared<Directory>(name);
-            dirs[id] = dir;
-            dirs[parentId]->addChild(dir);
-        } else if (operation == "FILE") {
-            long long parentId;
-            string readOnlyString, owner, group, nameExtension;
-            double size;
+public:
+    static constexpr uint32_t root = 0;
 
-            cin >> parentId >> readOnlyString >> owner >> group >> size >> nameExtension;
+    FlatTree() { nodes[addNode(FlatNode::none, "")].directory = true; }
 
-            bool readOnly = (readOnlyString == "T");
-            auto position = nameExtension.find_last_of('.');
-            string name = nameExtension.substr(0, position);
-            string extension = (position == string::npos ? "" : nameExtension.substr(position + 1));
-            // Get shared properties object
+    uint32_t addDirectory(uint32_t parent, string_view name)
+    {
+        uint32_t index = addNode(parent, name);
+        nodes[index].directory = true;
+        return index;
+    }
 
-            auto props = FilePropertiesFactory::get(extension, readOnly, owner, group);
-            auto file = make_shared<File>(nameExtension, size, props);
-            dirs[parentId]->addChild(file);
-        }
+    uint32_t addFile(uint32_t parent, string_view name, double sizeKB, const FileProperties* props)
+    {
+        uint32_t index = addNode(parent, name);
+        nodes[index].sizeKB = sizeKB;
+        nodes[index].props = props;
+        return index;
     }
 
-    // Use visitor to compute total size
-    SizeVisitor sizeVisitor;
-    root->accept(sizeVisitor);
-    cout << "total: " << sizeStr(sizeVisitor.getTotal()) << '\n';
+    size_t size() const { return nodes.size(); }
+    const FlatNode& node(uint32_t index) const { return nodes[index]; }
+    string_view name(uint32_t index) const { return {&names[nodes[index].name], nodes[index].nameLength}; }
+
+    // Visit from in the same order as Directory::accept: a directory, then its
+    // children in insertion order. Visitors get FlatFile and FlatDirectory views.
+    template <class V>
+    void accept(V& visitor, uint32_t from = root) const;
+};
+
+// Light views handed to visitors, they hold no ownership
+struct FlatFile
+{
+    const FlatTree& tree;
+    uint32_t index;
+
+    string_view getName() const { return tree.name(index); }
+    double getSize() const { return tree.node(index).sizeKB; }
+    const FileProperties& getProps() const { return *tree.node(index).props; }
+};
+
+struct FlatDirectory
+{
+    const FlatTree& tree;
+    uint32_t index;
+
+    string_view getName() const { return tree.name(index); }
+};
+
+inline void SizeVisitor::visit(const FlatFile& file) { total.add(file.getSize()); }
+
+template <class V>
+void FlatTree::accept(V& visitor, uint32_t from) const
+{
+    const FlatNode& start = nodes[from];
+    if (!start.directory) {
+        visitor.visit(FlatFile{*this, from});
+        return;
+    }
+    visitor.visit(FlatDirectory{*this, from});
+
+    // resume holds the sibling to continue with after each open directory
+    vector<uint32_t> resume;
+    uint32_t current = start.firstChild;
+    while (current != FlatNode::none)
+    {
+        const FlatNode& node = nodes[current];
+        if (node.directory) {
+            visitor.visit(FlatDirectory{*this, current});
+            if (node.firstChild != FlatNode::none) {
+                resume.push_back(node.nextSibling);
+                current = node.firstChild;
+                continue;
+            }
+        } else {
+            visitor.visit(FlatFile{*this, current});
+        }
+        current = node.nextSibling;
+        while (current == FlatNode::none && !resume.empty())
+        {
+            current = resume.back();
+            resume.pop_back();
+        }
+    }
+}
+
+// Frozen CSR tree
+// freeze() turns a finished Directory tree into flat arrays. Nodes are numbered in
+// depth-first preorder, so a subtree is the contiguous range [i, subtreeEnd[i]) and a
+// preorder visit is a plain loop over the arrays. Children are stored compressed
+// sparse row style: the children of node i are childIndex[childBegin[i] .. childBegin[i + 1]).
+// Sizes are kept as one double per node, so a subtree total is a sum over one array slice.
+// Every node also has a Merkle hash: a file hashes its name, size and properties,
+// a directory its name and its children's hashes, so equal hashes mean equal
+// subtrees and a diff only descends where they differ. Properties are hashed by
+// content, not flyweight id, so hashes compare across runs and snapshots.
+class InputBuffer;
+
+class FrozenTree
+{
+    // Arrays built by freeze(); a loaded snapshot leaves this empty and maps its file instead
+    struct Arrays
+    {
+        vector<double> sizes;
+        vector<uint64_t> hashes;
+        vector<uint32_t> propsIndex, subtreeEnd, childBegin, childIndex, nameBegin;
+        string names;
+    };
+    unique_ptr<Arrays> owned;
+    unique_ptr<InputBuffer> mapping;
+
+    span<const double> sizes;              // Files only, 0 for directories
+    span<const uint64_t> hashes;           // Merkle hash of each subtree
+    span<const uint32_t> propsIndex;       // Into properties, none for directories
+    span<const uint32_t> subtreeEnd;       // One past the last node of the subtree
+    span<const uint32_t> childBegin;       // CSR offsets into childIndex, size() + 1 entries
+    span<const uint32_t> childIndex;
+    span<const uint32_t> nameBegin;        // Offsets into names, size() + 1 entries
+    string_view names;
+    vector<const FileProperties*> properties; // Distinct flyweights, owned by FilePropertiesFactory
+
+    FrozenTree();
+
+    // Merkle hashes of every node, children before parents
+    vector<uint64_t> hashNodes() const;
+
+public:
+    static constexpr uint32_t none = UINT32_MAX;
+    static constexpr uint32_t root = 0;
+
+    FrozenTree(FrozenTree&&) noexcept;
+    FrozenTree& operator=(FrozenTree&&) noexcept;
+    ~FrozenTree();
+
+    static FrozenTree freeze(const Directory& top)
+    {
+        FrozenTree frozen;
+        frozen.owned = make_unique<Arrays>();
+        Arrays& tree = *frozen.owned;
+        unordered_map<const FileProperties*, uint32_t> propsIds;
+        vector<uint32_t> parents;
+
+        // Number the nodes in preorder with an explicit stack, remembering each parent
+        vector<pair<const Node*, uint32_t>> stack{{&top, none}};
+        while (!stack.empty())
+        {
+            auto [node, parent] = stack.back();
+            stack.pop_back();
+            uint32_t id = (uint32_t)parents.size();
+            parents.push_back(parent);
+            tree.nameBegin.push_back((uint32_t)tree.names.size());
+            tree.names += node->getName();
+
+            if (node->isDirectory()) {
+                tree.sizes.push_back(0);
+                tree.propsIndex.push_back(none);
+                const auto& children = static_cast<const Directory*>(node)->getChildren();
+                for (auto it = children.rbegin(); it != children.rend(); ++it)
+                    stack.push_back({it->get(), id});
+            } else {
+                auto* file = static_cast<const File*>(node);
+                tree.sizes.push_back(file->getSize());
+                auto [it, added] = propsIds.emplace(file->getProps().get(), (uint32_t)frozen.properties.size());
+                if (added)
+                    frozen.properties.push_back(it->first);
+                tree.propsIndex.push_back(it->second);
+            }
+        }
+        uint32_t n = (uint32_t)parents.size();
+        tree.nameBegin.push_back((uint32_t)tree.names.size());
+
+        // Counting sort by parent: children come out in preorder, i.e. insertion order
+        tree.childBegin.assign(n + 1, 0);
+        for (uint32_t i = 1; i < n; ++i)
+            ++tree.childBegin[parents[i] + 1];
+        for (uint32_t i = 0; i < n; ++i)
+            tree.childBegin[i + 1] += tree.childBegin[i];
+        tree.childIndex.resize(n - 1);
+        vector<uint32_t> fill(tree.childBegin.begin(), tree.childBegin.end() - 1);
+        for (uint32_t i = 1; i < n; ++i)
+            tree.childIndex[fill[parents[i]]++] = i;
+
+        // A subtree ends where the subtree of its last child ends
+        tree.subtreeEnd.resize(n);
+        for (uint32_t i = n; i-- > 0;)
+            tree.subtreeEnd[i] = tree.childBegin[i] == tree.childBegin[i + 1]
+                ? i + 1 : tree.subtreeEnd[tree.childIndex[tree.childBegin[i + 1] - 1]];
+
+        frozen.sizes = tree.sizes;
+        frozen.propsIndex = tree.propsIndex;
+        frozen.subtreeEnd = tree.subtreeEnd;
+        frozen.childBegin = tree.childBegin;
+        frozen.childIndex = tree.childIndex;
+        frozen.nameBegin = tree.nameBegin;
+        frozen.names = tree.names;
+        tree.hashes = frozen.hashNodes();
+        frozen.hashes = tree.hashes;
+        return frozen;
+    }
+
+    // Binary snapshot: write the arrays as they are, load them back by mapping the file
+    bool save(const string& path) const;
+    static optional<FrozenTree> load(const string& path);
+
+    uint32_t size() const { return (uint32_t)sizes.size(); }
+    bool isDirectory(uint32_t i) const { return propsIndex[i] == none; }
+    string_view name(uint32_t i) const { return names.substr(nameBegin[i], nameBegin[i + 1] - nameBegin[i]); }
+    double sizeKB(uint32_t i) const { return sizes[i]; }
+    const FileProperties& props(uint32_t i) const { return *properties[propsIndex[i]]; }
+    uint64_t hash(uint32_t i) const { return hashes[i]; }
+
+    span<const uint32_t> children(uint32_t i) const
+    {
+        return childIndex.subspan(childBegin[i], childBegin[i + 1] - childBegin[i]);
+    }
+    // Every node of the subtree of i, i included, in preorder
+    auto subtree(uint32_t i) const { return views::iota(i, subtreeEnd[i]); }
+
+    // Total size of the subtree of i: one pass over a contiguous slice
+    SizeSum subtreeSize(uint32_t i) const
+    {
+        SizeSum sum;
+        for (double size : sizes.subspan(i, subtreeEnd[i] - i))
+            sum.add(size);
+        return sum;
+    }
+
+    // Visit the subtree of from in Directory::accept order, which is index order here
+    template <class V>
+    void accept(V& visitor, uint32_t from = root) const;
+};
+
+struct FrozenFile
+{
+    const FrozenTree& tree;
+    uint32_t index;
+
+    string_view getName() const { return tree.name(index); }
+    double getSize() const { return tree.sizeKB(index); }
+    const FileProperties& getProps() const { return tree.props(index); }
+};
+
+struct FrozenDirectory
+{
+    const FrozenTree& tree;
+    uint32_t index;
+
+    string_view getName() const { return tree.name(index); }
+};
+
+inline void SizeVisitor::visit(const FrozenFile& file) { total.add(file.getSize()); }
+
+template <class V>
+void FrozenTree::accept(V& visitor, uint32_t from) const
+{
+    for (uint32_t i : subtree(from))
+    {
+        if (isDirectory(i))
+            visitor.visit(FrozenDirectory{*this, i});
+        else
+            visitor.visit(FrozenFile{*this, i});
+    }
+}
+
+// Tree rendering
+// TreeRenderer writes the Linux-style tree format without allocating per line.
+// The indent is one prefix buffer that grows and shrinks by a level, sizes are
+// formatted in place with to_chars, and the text goes through a large buffer
+// that reaches the stream in big chunks.
+class TreeRenderer
+{
+    static constexpr string_view branch = "├── ", lastBranch = "└── ";
+    static constexpr string_view indent = "│   ", lastIndent = "    ";
+
+    ostream& out;
+    string prefix;
+    vector<char> buffer;
+    size_t used = 0;
+
+    void write(string_view text)
+    {
+        if (text.size() > buffer.size() - used) {
+            flush();
+            if (text.size() > buffer.size()) {
+                out.write(text.data(), text.size());
+                return;
+            }
+        }
+        memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    // One line: prefix, branch, name and the size of files
+    void writeEntry(string_view name, bool isLast, bool isFile, double sizeKB)
+    {
+        write(prefix);
+        write(isLast ? lastBranch : branch);
+        write(name);
+        if (isFile) {
+            char text[maxSizeChars + 3] = " (";
+            char* end = formatSize(text + 2, sizeKB);
+            *end++ = ')';
+            write(string_view(text, end - text));
+        }
+        write("\n");
+    }
+
+    // Open a directory: indent its children and remember how to undo it
+    size_t enter(bool isLast)
+    {
+        size_t restore = prefix.size();
+        prefix += isLast ? lastIndent : indent;
+        return restore;
+    }
+
+    // The renderers below keep an explicit stack of open directories instead of
+    // recursing, so depth is bounded by heap memory rather than the call stack.
+    // Each frame records the prefix length to restore once its directory is done.
+    void renderChildren(const Directory& top)
+    {
+        struct Frame { const Directory* dir; size_t next; size_t restore; };
+        vector<Frame> stack{{&top, 0, prefix.size()}};
+        while (!stack.empty())
+        {
+            Frame& frame = stack.back();
+            const auto& children = frame.dir->getChildren();
+            if (frame.next == children.size()) {
+                prefix.resize(frame.restore);
+                stack.pop_back();
+                continue;
+            }
+            const Node& child = *children[frame.next++];
+            bool isLast = (frame.next == children.size());
+            bool isFile = child.kind() == NodeKind::File;
+            writeEntry(child.getName(), isLast, isFile, isFile ? static_cast<const File&>(child).getSize() : 0);
+            if (!isFile)
+                stack.push_back({static_cast<const Directory*>(&child), 0, enter(isLast)});
+        }
+    }
+
+    void renderChildren(const FlatTree& tree, uint32_t dir)
+    {
+        struct Frame { uint32_t next; size_t restore; }; // next: child to print, none when done
+        vector<Frame> stack{{tree.node(dir).firstChild, prefix.size()}};
+        while (!stack.empty())
+        {
+            Frame& frame = stack.back();
+            if (frame.next == FlatNode::none) {
+                prefix.resize(frame.restore);
+                stack.pop_back();
+                continue;
+            }
+            uint32_t child = frame.next;
+            const FlatNode& node = tree.node(child);
+            frame.next = node.nextSibling;
+            bool isLast = (node.nextSibling == FlatNode::none);
+            writeEntry(tree.name(child), isLast, !node.directory, node.sizeKB);
+            if (node.directory)
+                stack.push_back({node.firstChild, enter(isLast)});
+        }
+    }
+
+    void renderChildren(const FrozenTree& tree, uint32_t dir)
+    {
+        struct Frame { uint32_t dir; size_t next; size_t restore; };
+        vector<Frame> stack{{dir, 0, prefix.size()}};
+        while (!stack.empty())
+        {
+            Frame& frame = stack.back();
+            auto children = tree.children(frame.dir);
+            if (frame.next == children.size()) {
+                prefix.resize(frame.restore);
+                stack.pop_back();
+                continue;
+            }
+            uint32_t child = children[frame.next++];
+            bool isLast = (frame.next == children.size());
+            bool isFile = !tree.isDirectory(child);
+            writeEntry(tree.name(child), isLast, isFile, isFile ? tree.sizeKB(child) : 0);
+            if (!isFile)
+                stack.push_back({child, 0, enter(isLast)});
+        }
+    }
+
+public:
+    // prefix is the indent of the first level, the root line "." is only written without one
+    explicit TreeRenderer(ostream& out, string prefix = "", size_t bufferSize = 1 << 20)
+        : out(out), prefix(move(prefix)), buffer(max<size_t>(bufferSize, 1)) {}
+    TreeRenderer(const TreeRenderer&) = delete;
+    TreeRenderer& operator=(const TreeRenderer&) = delete;
+    ~TreeRenderer() { flush(); }
+
+    void flush()
+    {
+        out.write(buffer.data(), used);
+        used = 0;
+    }
+
+    void render(const Node& node)
+    {
+        if (node.kind() != NodeKind::Directory)
+            return;
+        if (prefix.empty())
+            write(".\n"); // Root
+        renderChildren(static_cast<const Directory&>(node));
+    }
+
+    void render(const FlatTree& tree, uint32_t dir = FlatTree::root)
+    {
+        if (prefix.empty())
+            write(".\n");
+        renderChildren(tree, dir);
+    }
+
+    void render(const FrozenTree& tree, uint32_t dir = FrozenTree::root)
+    {
+        if (prefix.empty())
+            write(".\n");
+        renderChildren(tree, dir);
+    }
+};
+
+// Print the directory tree in a Linux-style format
+void printTree(const shared_ptr<Node>& node,
+               const string& prefix, bool)
+{
+    TreeRenderer(cout, prefix).render(*node);
+}
+
+void printTree(const FlatTree& tree, uint32_t dir, const string& prefix)
+{
+    TreeRenderer(cout, prefix).render(tree, dir);
+}
+
+void printTree(const FrozenTree& tree, uint32_t dir, const string& prefix)
+{
+    TreeRenderer(cout, prefix).render(tree, dir);
+}
+
+// Path index
+// PathIndex resolves "/a/b/c.txt" to its node with one hash lookup per path
+// component, so a lookup costs O(path length) whatever the size of the tree.
+// It is a trie stored as a hash table of edges keyed by (parent directory, child
+// name); the key's name is a view of the child's own name, so no string is copied.
+// When a directory holds several children with the same name, the first one added
+// wins and the others wait in twins; when it is removed the next one takes over.
+class PathIndex
+{
+    struct Edge
+    {
+        const Directory* parent;
+        string_view name;
+        bool operator==(const Edge&) const = default;
+    };
+    struct EdgeHash
+    {
+        size_t operator()(const Edge& edge) const
+        {
+            return hash<string_view>{}(edge.name) ^ (size_t)((uintptr_t)edge.parent * 0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    Directory& root;
+    unordered_map<Edge, Node*, EdgeHash> edges;
+    unordered_map<Edge, deque<Node*>, EdgeHash> twins; // Same-named children not in edges, oldest first
+
+    // Key of node's own edge; it views the node's name, so it must be rekeyed
+    // before that node goes away
+    static Edge edgeOf(const Node& node) { return Edge{node.getParent(), node.getName()}; }
+
+public:
+    explicit PathIndex(Directory& root) : root(root) {}
+
+    // Index every node already below root
+    static unique_ptr<PathIndex> build(Directory& root)
+    {
+        auto index = make_unique<PathIndex>(root);
+        index->addBelow(root);
+        return index;
+    }
+
+    // Index a node once it has been added to its parent
+    void add(Node& node)
+    {
+        auto [it, added] = edges.emplace(edgeOf(node), &node);
+        if (!added)
+            twins[edgeOf(*it->second)].push_back(&node);
+    }
+
+    // Index everything below dir, which is not indexed itself
+    void addBelow(Directory& dir)
+    {
+        Directory::preorder(dir, [this](File& file) { add(file); },
+                            [this, &dir](Directory& sub) { if (&sub != &dir) add(sub); });
+    }
+
+    // Child of dir called name, nullptr if there is none
+    Node* child(const Directory& dir, string_view name) const
+    {
+        auto it = edges.find(Edge{&dir, name});
+        return it == edges.end() ? nullptr : it->second;
+    }
+
+    // Forget a node before it leaves its parent or is renamed. Its own children
+    // are keyed by the node itself, which does not change when it moves.
+    void remove(Node& node)
+    {
+        auto it = edges.find(edgeOf(node));
+        if (it == edges.end())
+            return;
+        auto waiting = twins.find(edgeOf(node));
+        if (it->second != &node) {
+            // A waiting twin: its key views the indexed node's name, which stays
+            if (waiting != twins.end()) {
+                erase(waiting->second, &node);
+                if (waiting->second.empty())
+                    twins.erase(waiting);
+            }
+            return;
+        }
+        edges.erase(it);
+        if (waiting == twins.end())
+            return;
+        // The oldest twin takes over, and both keys now view its name
+        deque<Node*> rest = move(waiting->second);
+        twins.erase(waiting);
+        Node* next = rest.front();
+        rest.pop_front();
+        edges.emplace(edgeOf(*next), next);
+        if (!rest.empty())
+            twins.emplace(edgeOf(*next), move(rest));
+    }
+
+    // Forget a node and everything below it, before the subtree is destroyed
+    void removeSubtree(Node& node)
+    {
+        remove(node);
+        if (node.kind() == NodeKind::Directory)
+            Directory::preorder(static_cast<Directory&>(node), [this](File& file) { remove(file); },
+                                [this, &node](Directory& dir) { if (&dir != &node) remove(dir); });
+    }
+
+    // Node at path, nullptr if there is none. Components are separated by '/',
+    // empty ones and "." are skipped, so "", "/" and "." all name the root.
+    Node* find(string_view path) const
+    {
+        Node* node = &root;
+        while (!path.empty())
+        {
+            size_t slash = path.find('/');
+            string_view component = path.substr(0, slash);
+            path.remove_prefix(slash == string_view::npos ? path.size() : slash + 1);
+            if (component.empty() || component == ".")
+                continue;
+            if (!node->isDirectory())
+                return nullptr;
+            auto it = edges.find(Edge{static_cast<Directory*>(node), component});
+            if (it == edges.end())
+                return nullptr;
+            node = it->second;
+        }
+        return node;
+    }
+
+    size_t size() const { return edges.size(); }
+};
+
+// Answer one lookup per line of queries: "path<TAB>file<TAB>size",
+// "path<TAB>dir<TAB>total<TAB>N files" or "path<TAB>not found"
+void lookupPaths(const PathIndex& index, string_view queries, ostream& out)
+{
+    while (!queries.empty())
+    {
+        size_t end = queries.find('\n');
+        string_view path = queries.substr(0, end);
+        queries.remove_prefix(end == string_view::npos ? queries.size() : end + 1);
+        if (!path.empty() && path.back() == '\r')
+            path.remove_suffix(1);
+        if (path.empty())
+            continue;
+
+        out << path << '\t';
+        Node* node = index.find(path);
+        if (!node)
+            out << "not found\n";
+        else if (node->isDirectory()) {
+            auto* dir = static_cast<Directory*>(node);
+            out << "dir\t" << sizeStr(dir->getTotal()) << '\t' << dir->getFileCount() << " files\n";
+        } else
+            out << "file\t" << sizeStr(static_cast<File*>(node)->getSize()) << '\n';
+    }
+}
+
+// Work-stealing thread pool
+// Every worker owns a deque of tasks: it pushes and pops at the back, idle workers
+// steal from the front of the others. Tasks may spawn more tasks, run() returns once
+// the root task and everything it spawned are done. A worker that finds nothing to
+// run sleeps on a condition variable until a task is queued or the last one ends,
+// so a few slow tasks do not keep the other cores spinning.
+// walk() visits a Directory tree this way: a task goes depth-first with a local
+// stack, and once it has seen cutoff nodes, it hands every pending directory
+// except the next one to the pool and starts counting again. Small subtrees never
+// pay for a task, big ones are split for idle workers to steal.
+class WorkStealingPool
+{
+    struct Queue
+    {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<Queue>> queues; // One deque per worker
+    atomic<size_t> pending{0};        // Spawned tasks that have not finished yet
+    exception_ptr failure;            // First exception thrown by a task
+    mutex failureLock;
+
+    // Parking: spawn() bumps wakeups, and only takes idleLock when someone sleeps
+    mutex idleLock;
+    condition_variable idle;
+    atomic<uint64_t> wakeups{0};
+    atomic<unsigned> sleeping{0};
+
+    static inline thread_local int current = -1; // Worker index of the calling thread
+
+    // Take a task from our own deque or steal one, run it, return false if there was none
+    bool runOne(unsigned self)
+    {
+        function<void()> task;
+        for (unsigned k = 0; k < queues.size() && !task; ++k)
+        {
+            Queue& queue = *queues[(self + k) % queues.size()];
+            lock_guard<mutex> guard(queue.lock);
+            if (queue.tasks.empty())
+                continue;
+            if (k == 0) {
+                task = move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+        if (!task)
+            return false;
+        try {
+            task();
+        } catch (...) {
+            lock_guard<mutex> guard(failureLock);
+            if (!failure)
+                failure = current_exception();
+        }
+        if (pending.fetch_sub(1, memory_order_acq_rel) == 1) {
+            lock_guard<mutex> guard(idleLock);
+            idle.notify_all();
+        }
+        return true;
+    }
+
+    // Sleep until a task is queued after seen was read, or none is pending.
+    // sleeping is raised before wakeups is checked again, and spawn() bumps
+    // wakeups before it reads sleeping, so one of the two always sees the other.
+    void park(uint64_t seen)
+    {
+        sleeping.fetch_add(1);
+        {
+            unique_lock<mutex> guard(idleLock);
+            idle.wait(guard, [&] { return wakeups.load() != seen || pending.load() == 0; });
+        }
+        sleeping.fetch_sub(1);
+    }
+
+public:
+    explicit WorkStealingPool(unsigned threads = thread::hardware_concurrency())
+    {
+        for (unsigned i = 0; i < max(threads, 1u); ++i)
+            queues.push_back(make_unique<Queue>());
+    }
+
+    unsigned size() const { return (unsigned)queues.size(); }
+    // Index of the worker running the current task, usable for per-thread tables
+    static int workerIndex() { return current; }
+
+    // Queue a task on the calling worker's deque (or the first one from outside the pool)
+    void spawn(function<void()> task)
+    {
+        pending.fetch_add(1, memory_order_relaxed);
+        Queue& queue = *queues[current >= 0 ? current : 0];
+        {
+            lock_guard<mutex> guard(queue.lock);
+            queue.tasks.push_back(move(task));
+        }
+        wakeups.fetch_add(1);
+        if (sleeping.load() != 0) {
+            lock_guard<mutex> guard(idleLock);
+            idle.notify_one();
+        }
+    }
+
+    // Run root and all tasks it spawns on size() threads
+    void run(function<void()> root)
+    {
+        spawn(move(root));
+        vector<thread> workers;
+        for (unsigned i = 0; i < size(); ++i)
+            workers.emplace_back([this, i] {
+                current = (int)i;
+                while (pending.load(memory_order_acquire) != 0)
+                {
+                    uint64_t seen = wakeups.load();
+                    if (!runOne(i))
+                        park(seen);
+                }
+                current = -1;
+            });
+        for (auto& worker : workers)
+            worker.join();
+        if (failure)
+            rethrow_exception(exchange(failure, nullptr));
+    }
+
+    // Call onFile(File&) for every file and onDirectory(Directory&) for every
+    // directory below top, on whichever worker reaches them, and return once all
+    // are done. Per-worker results can be kept by workerIndex().
+    template <class OnFile, class OnDirectory>
+    void walk(Directory& top, size_t cutoff, const OnFile& onFile, const OnDirectory& onDirectory)
+    {
+        run([&, dir = &top] { walkSubtree(dir, max<size_t>(cutoff, 1), onFile, onDirectory); });
+    }
+
+    template <class OnFile>
+    void walk(Directory& top, size_t cutoff, const OnFile& onFile)
+    {
+        walk(top, cutoff, onFile, [](Directory&) {});
+    }
+
+private:
+    template <class OnFile, class OnDirectory>
+    void walkSubtree(Directory* dir, size_t cutoff, const OnFile& onFile, const OnDirectory& onDirectory)
+    {
+        vector<Directory*> pending{dir};
+        size_t visited = 0;
+        while (!pending.empty())
+        {
+            Directory* current = pending.back();
+            pending.pop_back();
+            for (const auto& child : current->getChildren())
+            {
+                if (child->kind() == NodeKind::Directory) {
+                    auto* sub = static_cast<Directory*>(child.get());
+                    onDirectory(*sub);
+                    pending.push_back(sub);
+                } else {
+                    onFile(static_cast<File&>(*child));
+                }
+            }
+            visited += current->getChildren().size() + 1;
+            if (visited >= cutoff && pending.size() > 1) {
+                for (size_t i = 0; i + 1 < pending.size(); ++i)
+                    spawn([=, this, &onFile, &onDirectory, next = pending[i]] { walkSubtree(next, cutoff, onFile, onDirectory); });
+                pending.erase(pending.begin(), pending.end() - 1);
+                visited = 0;
+            }
+        }
+    }
+};
+
+// ParallelSizeVisitor: SizeVisitor over a WorkStealingPool
+// Every worker sums the files it reaches in WorkStealingPool::walk() into its own
+// partial SizeSum, and the partials are added up at the end. Exact sums make the
+// result equal to SizeVisitor's.
+class ParallelSizeVisitor
+{
+    WorkStealingPool& pool;
+    size_t cutoff;
+    SizeSum total;
+
+public:
+    explicit ParallelSizeVisitor(WorkStealingPool& pool, size_t cutoff = 4096) : pool(pool), cutoff(cutoff) {}
+
+    // Sum every file below root, returns once all tasks are done
+    void visit(Directory& root)
+    {
+        vector<BufferedSizeSum> partials(pool.size());
+        pool.walk(root, cutoff, [&partials](File& file) {
+            partials[WorkStealingPool::workerIndex()].add(file.getSize());
+        });
+        total = SizeSum();
+        for (const BufferedSizeSum& partial : partials)
+            total.add(partial.get());
+    }
+
+    double getTotal() const { return total.value(); }
+};
+
+// Group-by size reports
+// Files are first summed per flyweight: FileProperties ids are dense, so a file
+// costs one array index instead of hashing its owner or extension. Each pool
+// worker has its own table, merged at the end. The per-flyweight totals, a
+// short column, are then folded into any key through the interned string ids.
+enum class GroupKey { Extension, Owner, Group };
+
+class GroupBySize
+{
+    struct Totals
+    {
+        SizeSum size;
+        size_t files = 0;
+    };
+    vector<Totals> byProps; // Indexed by FileProperties::id
+
+    static void count(vector<Totals>& table, const File& file)
+    {
+        Totals& totals = table[file.getProps()->id];
+        totals.size.add(file.getSize());
+        ++totals.files;
+    }
+
+public:
+    struct Row
+    {
+        string_view name;
+        double sizeKB;
+        size_t files;
+    };
+
+    // Single pass over the files below root
+    void scan(Directory& root)
+    {
+        byProps.assign(FilePropertiesFactory::size(), {});
+        Directory::preorder(root, [this](File& file) { count(byProps, file); }, [](Directory&) {});
+    }
+
+    // The same on every worker of pool, with one table per worker
+    void scan(WorkStealingPool& pool, Directory& root, size_t cutoff = 4096)
+    {
+        size_t props = FilePropertiesFactory::size();
+        vector<vector<Totals>> tables(pool.size(), vector<Totals>(props));
+        pool.walk(root, cutoff, [&tables](File& file) { count(tables[WorkStealingPool::workerIndex()], file); });
+
+        byProps.assign(props, {});
+        for (const auto& table : tables)
+            for (size_t id = 0; id < props; ++id)
+            {
+                byProps[id].size.add(table[id].size);
+                byProps[id].files += table[id].files;
+            }
+    }
+
+    // Totals per key, largest first, then by name
+    vector<Row> report(GroupKey key) const
+    {
+        const StringPool& pool = key == GroupKey::Extension ? FilePropertiesFactory::extensionPool()
+            : key == GroupKey::Owner ? FilePropertiesFactory::ownerPool() : FilePropertiesFactory::groupPool();
+        vector<Totals> byKey(pool.size());
+        for (uint32_t id = 0; id < byProps.size(); ++id)
+        {
+            if (byProps[id].files == 0)
+                continue;
+            const FileProperties& props = FilePropertiesFactory::get(id);
+            uint32_t keyId = key == GroupKey::Extension ? props.extensionId
+                : key == GroupKey::Owner ? props.ownerId : props.groupId;
+            byKey[keyId].size.add(byProps[id].size);
+            byKey[keyId].files += byProps[id].files;
+        }
+
+        vector<Row> rows;
+        for (uint32_t id = 0; id < byKey.size(); ++id)
+            if (byKey[id].files != 0)
+                rows.push_back({pool.get(id), byKey[id].size.value(), byKey[id].files});
+        ranges::sort(rows, [](const Row& a, const Row& b) {
+            return a.sizeKB != b.sizeKB ? a.sizeKB > b.sizeKB : a.name < b.name;
+        });
+        return rows;
+    }
+};
+
+// Path of node from the root, as "/a/b/c.txt" ("/" for the root itself)
+string fullPath(const Node& node)
+{
+    vector<const Node*> chain;
+    for (const Node* n = &node; n->getParent(); n = n->getParent())
+        chain.push_back(n);
+    if (chain.empty())
+        return "/";
+    string path;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+        (path += '/') += (*it)->getName();
+    return path;
+}
+
+// Top-K largest files and directories
+// One pass keeps two min-heaps of at most K entries, so memory stays O(K) however
+// large the tree is. Directory totals come from the aggregates the tree already
+// caches, so the pass needs no post-order bookkeeping. In parallel, every pool
+// worker fills its own pair of heaps and they are merged at the end. Ties are
+// broken by comparing names up the parent chains for as long as they are equal,
+// which tells nodes apart by their paths without building them or looking at
+// where they were allocated, so the result does not depend on the thread count. Paths
+// are only built for the K entries kept, to list equal sizes in path order.
+class TopK
+{
+public:
+    struct Entry
+    {
+        double sizeKB;
+        const Node* node;
+    };
+
+private:
+    struct Heaps
+    {
+        vector<Entry> files, directories;
+    };
+    size_t k;
+    Heaps result;
+
+    // Larger first, equal sizes by name, then by the names of their parents, then
+    // shallower first. Same-named siblings compare equal and print the same line.
+    static bool before(const Entry& a, const Entry& b)
+    {
+        if (a.sizeKB != b.sizeKB)
+            return a.sizeKB > b.sizeKB;
+        const Node* x = a.node;
+        const Node* y = b.node;
+        for (; x && y && x != y; x = x->getParent(), y = y->getParent())
+            if (x->getName() != y->getName())
+                return x->getName() < y->getName();
+        return !x && y;
+    }
+
+    void offer(vector<Entry>& heap, Entry entry) const
+    {
+        if (heap.size() < k) {
+            heap.push_back(entry);
+            ranges::push_heap(heap, before);
+        } else if (before(entry, heap.front())) {
+            ranges::pop_heap(heap, before);
+            heap.back() = entry;
+            ranges::push_heap(heap, before);
+        }
+    }
+
+    void offer(Heaps& heaps, const File& file) const { offer(heaps.files, {file.getSize(), &file}); }
+    void offer(Heaps& heaps, const Directory& dir) const { offer(heaps.directories, {dir.getTotal(), &dir}); }
+
+public:
+    explicit TopK(size_t k) : k(k) {}
+
+    // The root itself is not ranked, only what is below it
+    void scan(Directory& root)
+    {
+        result = {};
+        if (k > 0)
+            Directory::preorder(root, [this](File& file) { offer(result, file); },
+                                [this, &root](Directory& dir) { if (&dir != &root) offer(result, dir); });
+    }
+
+    void scan(WorkStealingPool& pool, Directory& root, size_t cutoff = 4096)
+    {
+        result = {};
+        if (k == 0)
+            return;
+        vector<Heaps> heaps(pool.size());
+        pool.walk(root, cutoff, [this, &heaps](File& file) { offer(heaps[WorkStealingPool::workerIndex()], file); },
+                  [this, &heaps](Directory& dir) { offer(heaps[WorkStealingPool::workerIndex()], dir); });
+        for (const Heaps& local : heaps)
+        {
+            for (const Entry& entry : local.files)
+                offer(result.files, entry);
+            for (const Entry& entry : local.directories)
+                offer(result.directories, entry);
+        }
+    }
+
+    // Largest first, equal sizes by path
+    vector<Entry> files() const { return sorted(result.files); }
+    vector<Entry> directories() const { return sorted(result.directories); }
+
+private:
+    static vector<Entry> sorted(const vector<Entry>& heap)
+    {
+        vector<pair<string, Entry>> byPath;
+        for (const Entry& entry : heap)
+            byPath.push_back({fullPath(*entry.node), entry});
+        ranges::sort(byPath, [](const auto& a, const auto& b) {
+            return a.second.sizeKB != b.second.sizeKB ? a.second.sizeKB > b.second.sizeKB : a.first < b.first;
+        });
+        vector<Entry> entries;
+        for (const auto& [path, entry] : byPath)
+            entries.push_back(entry);
+        return entries;
+    }
+};
+
+// Print both rankings as "size<TAB>path" lines
+void printTopK(const TopK& top, ostream& out)
+{
+    out << "largest files:\n";
+    for (const auto& entry : top.files())
+        out << sizeStr(entry.sizeKB) << '\t' << fullPath(*entry.node) << '\n';
+    out << "largest directories:\n";
+    for (const auto& entry : top.directories())
+        out << sizeStr(entry.sizeKB) << '\t' << fullPath(*entry.node) << '\n';
+}
+
+// Print a group-by report as "key<TAB>size<TAB>files" lines
+void printGroups(const vector<GroupBySize::Row>& rows, ostream& out)
+{
+    for (const auto& row : rows)
+        out << (row.name.empty() ? "(none)" : row.name) << '\t' << sizeStr(row.sizeKB) << '\t' << row.files << '\n';
+}
+
+// Glob filters
+// GlobFilter compiles glob patterns into an NFA once and runs it as a DFA whose
+// states are built lazily, the first time a (state, byte) transition is needed,
+// so matching costs one table lookup per character. Patterns are anchored at the
+// root and matched against paths like "var/log/syslog" (a leading '/' is optional):
+//   *  any characters but '/'     ?  one character but '/'     [a-z] [!a-z]  a class
+//   ** as a whole component matches any number of components, "a/**" all below a
+// State 0 is dead: nothing starting with what was read can match, which is what
+// lets a traversal skip whole subtrees. A state that contains a trailing "**"
+// accepts everything that can follow, so a traversal can take a subtree whole.
+class GlobFilter
+{
+    using CharSet = bitset<256>;
+
+    struct NfaState
+    {
+        vector<pair<CharSet, int>> edges;
+        vector<int> epsilons;
+        bool accepting = false;
+        bool acceptsAll = false; // Trailing "**": accepting, and loops on every byte
+    };
+    struct DfaState
+    {
+        array<int, 256> next; // -1 until computed
+        bool accepting;
+        bool acceptsAll;
+        const vector<int>* states; // Key in dfaIds
+    };
+
+    vector<NfaState> nfa;
+    vector<int> starts; // First state of each pattern
+    vector<DfaState> dfa;
+    map<vector<int>, int> dfaIds; // NFA state set -> DFA state
+    int startState = 0;
+
+    int addState()
+    {
+        nfa.emplace_back();
+        return (int)nfa.size() - 1;
+    }
+
+    int addEdge(int from, const CharSet& chars)
+    {
+        int to = addState();
+        nfa[from].edges.push_back({chars, to});
+        return to;
+    }
+
+    // Parse "[...]" at pattern[i], nullopt if it is not closed
+    static optional<CharSet> parseClass(string_view pattern, size_t& i)
+    {
+        size_t j = i + 1;
+        bool negated = j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^');
+        if (negated)
+            ++j;
+        CharSet chars;
+        for (bool first = true; j < pattern.size() && (first || pattern[j] != ']'); first = false)
+        {
+            unsigned char low = pattern[j];
+            if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+                for (unsigned c = low; c <= (unsigned char)pattern[j + 2]; ++c)
+                    chars.set(c);
+                j += 3;
+            } else {
+                chars.set(low);
+                ++j;
+            }
+        }
+        if (j >= pattern.size())
+            return nullopt;
+        i = j + 1;
+        if (negated)
+            chars.flip();
+        chars.reset('/');
+        return chars;
+    }
+
+    void addPattern(string_view pattern)
+    {
+        while (!pattern.empty() && pattern.front() == '/')
+            pattern.remove_prefix(1);
+        CharSet any, notSlash, slash;
+        any.set();
+        notSlash.set();
+        notSlash.reset('/');
+        slash.set('/');
+
+        int current = addState();
+        starts.push_back(current);
+        for (size_t i = 0; i < pattern.size();)
+        {
+            bool componentStart = i == 0 || pattern[i - 1] == '/';
+            if (componentStart && pattern.substr(i, 2) == "**" && (i + 2 == pattern.size() || pattern[i + 2] == '/')) {
+                int next = addState();
+                nfa[current].epsilons.push_back(next);
+                if (i + 2 == pattern.size()) { // Trailing "**": anything at all
+                    nfa[next].edges.push_back({any, next});
+                    nfa[next].acceptsAll = true;
+                } else { // "**/": whole components, each ending with '/'
+                    int inside = addEdge(current, notSlash);
+                    nfa[inside].edges.push_back({notSlash, inside});
+                    nfa[inside].edges.push_back({slash, current});
+                }
+                current = next;
+                i += i + 2 == pattern.size() ? 2 : 3;
+                continue;
+            }
+
+            char c = pattern[i];
+            if (c == '*') {
+                int next = addState();
+                nfa[current].epsilons.push_back(next);
+                nfa[next].edges.push_back({notSlash, next});
+                current = next;
+                while (i < pattern.size() && pattern[i] == '*')
+                    ++i;
+                continue;
+            }
+            CharSet chars;
+            if (c == '?') {
+                chars = notSlash;
+                ++i;
+            } else if (optional<CharSet> set = c == '[' ? parseClass(pattern, i) : nullopt) {
+                chars = *set;
+            } else {
+                if (c == '\\' && i + 1 < pattern.size())
+                    ++i;
+                chars.set((unsigned char)pattern[i++]);
+            }
+            current = addEdge(current, chars);
+        }
+        nfa[current].accepting = true;
+    }
+
+    // The set plus every state reachable through epsilon edges, sorted
+    vector<int> closure(vector<int> states) const
+    {
+        vector<bool> seen(nfa.size());
+        for (int state : states)
+            seen[state] = true;
+        for (size_t k = 0; k < states.size(); ++k)
+            for (int next : nfa[states[k]].epsilons)
+                if (!seen[next]) {
+                    seen[next] = true;
+                    states.push_back(next);
+                }
+        ranges::sort(states);
+        return states;
+    }
+
+    int dfaState(vector<int> states)
+    {
+        auto [it, added] = dfaIds.emplace(move(states), (int)dfa.size());
+        if (added) {
+            DfaState state;
+            state.next.fill(it->first.empty() ? 0 : -1);
+            state.accepting = ranges::any_of(it->first, [this](int s) { return nfa[s].accepting; });
+            state.acceptsAll = ranges::any_of(it->first, [this](int s) { return nfa[s].acceptsAll; });
+            state.states = &it->first;
+            dfa.push_back(state);
+        }
+        return it->second;
+    }
+
+public:
+    explicit GlobFilter(const vector<string>& patterns)
+    {
+        for (const string& pattern : patterns)
+            addPattern(pattern);
+        dfaState({}); // Dead state 0
+        startState = dfaState(closure(starts));
+    }
+
+    int start() const { return startState; }
+    bool dead(int state) const { return state == 0; }
+    bool accepting(int state) const { return dfa[state].accepting; }
+    // Every continuation of what was read matches
+    bool acceptsAll(int state) const { return dfa[state].acceptsAll; }
+
+    int step(int state, unsigned char c)
+    {
+        if (int next = dfa[state].next[c]; next >= 0)
+            return next;
+        vector<int> moved;
+        for (int s : *dfa[state].states)
+            for (const auto& [chars, to] : nfa[s].edges)
+                if (chars.test(c))
+                    moved.push_back(to);
+        int next = dfaState(closure(move(moved)));
+        dfa[state].next[c] = next;
+        return next;
+    }
+
+    int step(int state, string_view text)
+    {
+        for (char c : text)
+        {
+            state = step(state, (unsigned char)c);
+            if (dead(state))
+                break;
+        }
+        return state;
+    }
+};
+
+// GlobSizeVisitor: SizeVisitor restricted to files whose path matches a GlobFilter
+// The DFA state of each directory's path is carried down the walk, so a name is
+// matched once whatever its depth. A subtree is skipped as soon as its path puts
+// the DFA in the dead state. Directories are only matched to decide that: when
+// every path below one matches (its "dir/" leaves the DFA accepting everything),
+// it counts as a whole, from its cached total, without being descended.
+class GlobSizeVisitor
+{
+    GlobFilter& filter;
+    SizeSum total;
+    size_t files = 0;
+
+public:
+    explicit GlobSizeVisitor(GlobFilter& filter) : filter(filter) {}
+
+    void visit(Directory& root)
+    {
+        if (filter.acceptsAll(filter.start())) {
+            total.add(root.getTotal());
+            files += root.getFileCount();
+            return;
+        }
+        vector<pair<Directory*, int>> stack{{&root, filter.start()}};
+        while (!stack.empty())
+        {
+            auto [dir, state] = stack.back();
+            stack.pop_back();
+            for (const auto& child : dir->getChildren())
+            {
+                int matched = filter.step(state, child->getName());
+                if (filter.dead(matched))
+                    continue;
+                if (child->kind() == NodeKind::File) {
+                    if (filter.accepting(matched)) {
+                        total.add(static_cast<File&>(*child).getSize());
+                        ++files;
+                    }
+                    continue;
+                }
+                auto& sub = static_cast<Directory&>(*child);
+                int inside = filter.step(matched, '/');
+                if (filter.acceptsAll(inside)) {
+                    total.add(sub.getTotal());
+                    files += sub.getFileCount();
+                } else if (!filter.dead(inside)) {
+                    stack.push_back({&sub, inside});
+                }
+            }
+        }
+    }
+
+    double getTotal() const { return total.value(); }
+    size_t getFileCount() const { return files; }
+};
+
+// A directory entry read by getdents64, together with its statx result once fetched
+struct DirEntry
+{
+    string name;
+    unsigned char type;     // d_type, DT_UNKNOWN if the filesystem does not report it
+    struct statx stx{};
+    int error = 0;          // errno of the statx call, 0 on success
+};
+
+// io_uring statx batches
+// One ring per thread. statBatch() queues a statx for every entry of a directory,
+// submits them with a single io_uring_enter and reaps the completions, so the kernel
+// can overlap the lookups instead of us waiting on each one in turn.
+// If io_uring_enter fails, the requests the kernel already took still write into
+// the batch, so submit() waits for all of them before the caller falls back, and
+// the ring, with requests it never took, is not used again.
+class UringStatx
+{
+    int ringFd = -1;
+    unsigned entries = 0;
+    bool broken = false;
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    size_t sqRingSize = 0, cqRingSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+
+    // Pointers into the shared rings
+    atomic<unsigned>* sqHead = nullptr;
+    atomic<unsigned>* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    atomic<unsigned>* cqHead = nullptr;
+    atomic<unsigned>* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    template <class T>
+    static T* at(void* ring, unsigned offset) { return reinterpret_cast<T*>(static_cast<char*>(ring) + offset); }
+
+    explicit UringStatx(unsigned size)
+    {
+        io_uring_params params{};
+        ringFd = (int)syscall(SYS_io_uring_setup, size, &params);
+        if (ringFd < 0)
+            return;
+        entries = params.sq_entries;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+            return;
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            cqRing = sqRing;
+        else
+            cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+            return;
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe),
+                                               PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+            return;
+
+        sqHead = at<atomic<unsigned>>(sqRing, params.sq_off.head);
+        sqTail = at<atomic<unsigned>>(sqRing, params.sq_off.tail);
+        sqMask = at<unsigned>(sqRing, params.sq_off.ring_mask);
+        sqArray = at<unsigned>(sqRing, params.sq_off.array);
+        cqHead = at<atomic<unsigned>>(cqRing, params.cq_off.head);
+        cqTail = at<atomic<unsigned>>(cqRing, params.cq_off.tail);
+        cqMask = at<unsigned>(cqRing, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+    }
+
+    bool usable() const { return cqes != nullptr; }
+
+    // Submit count statx requests for batch[first..] and wait for all of them
+    bool submit(int dirfd, vector<DirEntry*>& batch, size_t first, unsigned count)
+    {
+        unsigned tail = sqTail->load(memory_order_relaxed);
+        for (unsigned k = 0; k < count; ++k)
+        {
+            unsigned slot = (tail + k) & *sqMask;
+            DirEntry* entry = batch[first + k];
+            io_uring_sqe& sqe = sqes[slot];
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_STATX;
+            sqe.fd = dirfd;
+            sqe.addr = reinterpret_cast<uint64_t>(entry->name.c_str());
+            sqe.len = STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE;
+            sqe.off = reinterpret_cast<uint64_t>(&entry->stx);
+            sqe.statx_flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+            sqe.user_data = first + k;
+            sqArray[slot] = slot;
+        }
+        sqTail->store(tail + count, memory_order_release);
+
+        // After a failure only wait, for the requests the kernel has taken off the queue
+        for (unsigned done = 0;;)
+        {
+            unsigned taken = sqHead->load(memory_order_acquire) - tail;
+            if (done == (broken ? taken : count))
+                return !broken;
+            unsigned toSubmit = broken ? 0 : count - taken;
+            long result = syscall(SYS_io_uring_enter, ringFd, toSubmit, (broken ? taken : count) - done,
+                                  IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result < 0 && errno != EINTR) {
+                if (broken)
+                    this_thread::yield();
+                broken = true;
+            }
+            unsigned head = cqHead->load(memory_order_relaxed);
+            unsigned ready = cqTail->load(memory_order_acquire);
+            for (; head != ready; ++head, ++done)
+            {
+                const io_uring_cqe& cqe = cqes[head & *cqMask];
+                batch[cqe.user_data]->error = cqe.res < 0 ? -cqe.res : 0;
+            }
+            cqHead->store(head, memory_order_release);
+        }
+    }
+
+public:
+    UringStatx(const UringStatx&) = delete;
+    UringStatx& operator=(const UringStatx&) = delete;
+
+    ~UringStatx()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, entries * sizeof(io_uring_sqe));
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if (ringFd >= 0)
+            close(ringFd);
+    }
+
+    // Ring of the calling thread, nullptr if io_uring or its statx opcode is unavailable
+    // or the ring failed
+    static UringStatx* forThread()
+    {
+        static thread_local unique_ptr<UringStatx> ring;
+        static thread_local bool tried = false;
+        if (ring && ring->broken)
+            ring.reset();
+        if (!tried) {
+            tried = true;
+            unique_ptr<UringStatx> candidate(new UringStatx(256));
+            // Kernels without IORING_OP_STATX fail the request with EINVAL
+            DirEntry probe{".", DT_UNKNOWN};
+            vector<DirEntry*> batch{&probe};
+            if (candidate->usable() && candidate->submit(AT_FDCWD, batch, 0, 1) && probe.error != EINVAL)
+                ring = move(candidate);
+        }
+        return ring.get();
+    }
+
+    // statx every entry of batch relative to dirfd, filling stx and error
+    bool statBatch(int dirfd, vector<DirEntry*>& batch)
+    {
+        for (size_t first = 0; first < batch.size(); first += entries)
+            if (!submit(dirfd, batch, first, (unsigned)min<size_t>(entries, batch.size() - first)))
+                return false;
+        return true;
+    }
+};
+
+// How the walker fetches file metadata
+enum class StatMode
+{
+    Uring,   // One io_uring batch per directory, falls back to Threads if unavailable
+    Threads  // Blocking statx per entry on the pool threads
+};
+
+// Filesystem walker
+// Builds the same Directory/File tree as the DIR/FILE commands, but from a real path.
+// Every directory is one pool task: it is read with openat/getdents64, its entries are
+// sorted by name and stat'ed with statx, and its subdirectories are spawned as new tasks.
+// A task only adds children to its own Directory, so the tree needs no locking.
+class FilesystemWalker
+{
+    // Record layout returned by getdents64
+    struct LinuxDirent64
+    {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    WorkStealingPool pool;
+    StatMode statMode;
+
+    // Owner and group names are looked up once per id and thread
+    static const string& ownerName(uid_t uid)
+    {
+        static thread_local unordered_map<uid_t, string> names;
+        auto it = names.find(uid);
+        if (it != names.end())
+            return it->second;
+        passwd entry{}, *result = nullptr;
+        char buffer[4096];
+        getpwuid_r(uid, &entry, buffer, sizeof(buffer), &result);
+        return names.emplace(uid, result ? string(result->pw_name) : to_string(uid)).first->second;
+    }
+
+    static const string& groupName(gid_t gid)
+    {
+        static thread_local unordered_map<gid_t, string> names;
+        auto it = names.find(gid);
+        if (it != names.end())
+            return it->second;
+        group entry{}, *result = nullptr;
+        char buffer[4096];
+        getgrgid_r(gid, &entry, buffer, sizeof(buffer), &result);
+        return names.emplace(gid, result ? string(result->gr_name) : to_string(gid)).first->second;
+    }
+
+    // Read all entries of an open directory except "." and ".."
+    static vector<DirEntry> readEntries(int dirfd)
+    {
+        vector<DirEntry> entries;
+        alignas(LinuxDirent64) char buffer[64 * 1024];
+        for (;;)
+        {
+            long n = syscall(SYS_getdents64, dirfd, buffer, sizeof(buffer));
+            if (n <= 0)
+                break;
+            for (long offset = 0; offset < n;)
+            {
+                auto* dirent = reinterpret_cast<LinuxDirent64*>(buffer + offset);
+                offset += dirent->d_reclen;
+                string_view name(dirent->d_name);
+                if (name == "." || name == "..")
+                    continue;
+                entries.push_back({string(name), dirent->d_type});
+            }
+        }
+        sort(entries.begin(), entries.end(),
+             [](const DirEntry& a, const DirEntry& b) { return a.name < b.name; });
+        return entries;
+    }
+
+    // Fill stx for every entry of batch, in one io_uring batch if possible
+    void fetchMetadata(int dirfd, vector<DirEntry*>& batch)
+    {
+        if (statMode == StatMode::Uring)
+            if (UringStatx* ring = UringStatx::forThread())
+                if (ring->statBatch(dirfd, batch))
+                    return;
+        for (DirEntry* entry : batch)
+            if (statx(dirfd, entry->name.c_str(), AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                      STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE, &entry->stx) != 0)
+                entry->error = errno;
+    }
+
+    // Task body: fill dir with the entries of path and spawn its subdirectories
+    void listDirectory(Directory* dir, string path)
+    {
+        int dirfd = openat(AT_FDCWD, path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dirfd < 0) {
+            cerr << "cannot open " << path << ": " << strerror(errno) << '\n';
+            return;
+        }
+        auto entries = readEntries(dirfd);
+
+        // Directories need no metadata, so skip statx when d_type already tells us
+        vector<DirEntry*> batch;
+        for (auto& entry : entries)
+            if (entry.type != DT_DIR)
+                batch.push_back(&entry);
+        fetchMetadata(dirfd, batch);
+        close(dirfd);
+
+        // Children go in together, so the ancestors' totals change once per directory
+        vector<shared_ptr<Node>> children;
+        vector<Directory*> subdirectories;
+        for (auto& entry : entries)
+        {
+            if (entry.error != 0) {
+                cerr << "cannot stat " << path << '/' << entry.name << ": " << strerror(entry.error) << '\n';
+            } else if (entry.type == DT_DIR || S_ISDIR(entry.stx.stx_mode)) {
+                auto child = make_shared<Directory>(move(entry.name));
+                subdirectories.push_back(child.get());
+                children.push_back(move(child));
+            } else {
+                children.push_back(makeFile(move(entry.name), entry.stx));
+            }
+        }
+        dir->addChildren(move(children));
+
+        for (Directory* child : subdirectories)
+            pool.spawn([this, child, childPath = path + "/" + child->getName()]() mutable {
+                listDirectory(child, move(childPath));
+            });
+    }
+
+public:
+    FilesystemWalker(unsigned threads, StatMode statMode) : pool(threads), statMode(statMode) {}
+
+    // File node for a statx result, needs STATX_MODE, STATX_UID, STATX_GID and STATX_SIZE
+    static shared_ptr<File> makeFile(string nameExtension, const struct statx& stx)
+    {
+        bool readOnly = (stx.stx_mode & S_IWUSR) == 0;
+
+        auto props = FilePropertiesFactory::get(extensionOf(nameExtension), readOnly,
+                                                ownerName(stx.stx_uid), groupName(stx.stx_gid));
+        return make_shared<File>(move(nameExtension), stx.stx_size / 1024.0, move(props), S_ISREG(stx.stx_mode));
+    }
+
+    // Walk path and return it as the root directory
+    shared_ptr<Directory> walk(const string& path)
+    {
+        auto root = make_shared<Directory>("");
+        pool.run([this, dir = root.get(), path] { listDirectory(dir, path); });
+        return root;
+    }
+};
+
+// Live watch mode
+// Watcher keeps a walked tree in sync with the filesystem. Every directory has an
+// inotify watch. Events are not applied one at a time: the names they touch are
+// collected until the stream has been quiet for a short window, then each touched
+// name is checked once against the filesystem and the tree is patched with
+// addChild/removeChild/setFileSize, whose O(depth) updates keep every cached total
+// current. Renames inside the tree are paired by cookie and become moves, so the
+// moved subtree and its watches are kept. On queue overflow the tree is walked
+// again. Entries created inside a new directory while it is being scanned may only
+// show up once they are touched again.
+// Queries come in on a Unix socket, one path per line, and are answered between
+// batches from the cached totals, in the format of --lookup.
+class Watcher
+{
+    struct Event
+    {
+        int wd;
+        uint32_t mask, cookie;
+        string name;
+    };
+
+    static constexpr uint32_t watchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB
+        | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+    string base;
+    unsigned threads;
+    StatMode statMode;
+    chrono::milliseconds quiet;
+    int inotifyFd = -1;
+    shared_ptr<Directory> root;
+    unique_ptr<PathIndex> index;
+    unordered_map<int, Directory*> watched;       // Watch descriptor -> directory
+    unordered_map<const Directory*, int> watches; // Directory -> watch descriptor
+
+    static inline volatile sig_atomic_t stopRequested = 0;
+
+    string pathOf(const Directory& dir) const { return &dir == root.get() ? base : base + fullPath(dir); }
+
+    // Watch every directory from top down
+    void watchSubtree(Directory& top)
+    {
+        Directory::preorder(top, [](File&) {}, [this](Directory& dir) {
+            int wd = inotify_add_watch(inotifyFd, pathOf(dir).c_str(), watchMask);
+            if (wd < 0) {
+                cerr << "cannot watch " << pathOf(dir) << ": " << strerror(errno) << '\n';
+                return;
+            }
+            watched[wd] = &dir;
+            watches[&dir] = wd;
+        });
+    }
+
+    void unwatchSubtree(Node& top)
+    {
+        if (top.kind() != NodeKind::Directory)
+            return;
+        Directory::preorder(static_cast<Directory&>(top), [](File&) {}, [this](Directory& dir) {
+            auto it = watches.find(&dir);
+            if (it == watches.end())
+                return;
+            inotify_rm_watch(inotifyFd, it->second);
+            watched.erase(it->second);
+            watches.erase(it);
+        });
+    }
+
+    // Walk the whole tree again, used at start and when events were lost
+    void rescan()
+    {
+        for (auto [wd, dir] : watched)
+            inotify_rm_watch(inotifyFd, wd);
+        watched.clear();
+        watches.clear();
+        index.reset();
+        root = FilesystemWalker(threads, statMode).walk(base);
+        index = PathIndex::build(*root);
+        watchSubtree(*root);
+    }
+
+    void removeNode(Node& node)
+    {
+        unwatchSubtree(node);
+        index->removeSubtree(node);
+        node.getParent()->removeChild(node);
+    }
+
+    // Apply a rename whose both ends are watched, false if the source is not in the tree
+    bool moveEntry(const Event& from, const Event& to)
+    {
+        auto source = watched.find(from.wd), target = watched.find(to.wd);
+        if (source == watched.end() || target == watched.end())
+            return false;
+        Node* node = index->child(*source->second, from.name);
+        if (!node)
+            return false;
+        Node* replaced = index->child(*target->second, to.name);
+        if (replaced == node)
+            return true;
+        if (replaced)
+            removeNode(*replaced);
+        index->remove(*node);
+        shared_ptr<Node> moved = source->second->removeChild(*node);
+        moved->setName(to.name);
+        target->second->addChild(moved);
+        index->add(*moved);
+        return true;
+    }
+
+    // Make the child name of the watched directory match the filesystem
+    void reconcile(int wd, const string& name)
+    {
+        auto it = watched.find(wd);
+        if (it == watched.end())
+            return;
+        Directory& dir = *it->second;
+        string path = pathOf(dir) + '/' + name;
+        struct statx stx{};
+        bool exists = statx(AT_FDCWD, path.c_str(), AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                            STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE, &stx) == 0;
+        Node* node = index->child(dir, name);
+
+        if (!exists) {
+            if (node)
+                removeNode(*node);
+        } else if (S_ISDIR(stx.stx_mode)) {
+            if (node && node->isDirectory())
+                return;
+            if (node)
+                removeNode(*node);
+            shared_ptr<Directory> sub = FilesystemWalker(threads, statMode).walk(path);
+            sub->setName(name);
+            dir.addChild(sub);
+            index->add(*sub);
+            index->addBelow(*sub);
+            watchSubtree(*sub);
+        } else {
+            shared_ptr<File> file = FilesystemWalker::makeFile(name, stx);
+            if (node && !node->isDirectory()) {
+                auto& current = static_cast<File&>(*node);
+                if (current.getProps() == file->getProps()) {
+                    dir.setFileSize(current, file->getSize());
+                    return;
+                }
+            }
+            if (node)
+                removeNode(*node);
+            dir.addChild(file);
+            index->add(*file);
+        }
+    }
+
+    void applyBatch(vector<Event>& events)
+    {
+        for (const Event& event : events)
+            if (event.mask & IN_Q_OVERFLOW) {
+                rescan();
+                return;
+            }
+
+        unordered_map<uint32_t, size_t> movedTo; // Cookie -> MOVED_TO event
+        for (size_t i = 0; i < events.size(); ++i)
+            if (events[i].mask & IN_MOVED_TO)
+                movedTo[events[i].cookie] = i;
+
+        set<pair<int, string>> touched;
+        vector<bool> paired(events.size());
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            const Event& event = events[i];
+            if (event.mask & IN_IGNORED) {
+                auto it = watched.find(event.wd);
+                if (it != watched.end()) {
+                    watches.erase(it->second);
+                    watched.erase(it);
+                }
+                continue;
+            }
+            if (event.name.empty() || paired[i])
+                continue;
+            auto to = event.mask & IN_MOVED_FROM ? movedTo.find(event.cookie) : movedTo.end();
+            if (to != movedTo.end()) {
+                const Event& target = events[to->second];
+                paired[to->second] = true;
+                if (!moveEntry(event, target))
+                    touched.insert({event.wd, event.name});
+                touched.insert({target.wd, target.name}); // The moved entry may have changed too
+                continue;
+            }
+            touched.insert({event.wd, event.name});
+        }
+        for (const auto& [wd, name] : touched)
+            reconcile(wd, name);
+    }
+
+    // Read every queued inotify event
+    void readEvents(vector<Event>& events)
+    {
+        alignas(inotify_event) char buffer[64 * 1024];
+        for (;;)
+        {
+            ssize_t n = read(inotifyFd, buffer, sizeof(buffer));
+            if (n <= 0)
+                return;
+            for (ssize_t offset = 0; offset < n;)
+            {
+                auto* event = reinterpret_cast<inotify_event*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                events.push_back({event->wd, event->mask, event->cookie, event->len ? string(event->name) : string()});
+            }
+        }
+    }
+
+    // Answer every complete line a client sent, false once it has gone. A client
+    // that shuts down its side still gets the answers to what it sent, the last
+    // line included even without its newline.
+    bool serve(int fd, string& pending)
+    {
+        char buffer[4096];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+            pending.append(buffer, n);
+        bool ended = n == 0;
+        if (!ended && errno != EAGAIN && errno != EWOULDBLOCK)
+            return false;
+        size_t end = ended ? pending.size() - 1 : pending.rfind('\n');
+        if (end == string::npos)
+            return !ended;
+        ostringstream answer;
+        lookupPaths(*index, string_view(pending).substr(0, end + 1), answer);
+        pending.erase(0, end + 1);
+        string text = answer.str();
+        for (size_t sent = 0; sent < text.size();)
+        {
+            ssize_t written = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    return false;
+                pollfd out{fd, POLLOUT, 0};
+                poll(&out, 1, -1);
+                continue;
+            }
+            sent += written;
+        }
+        return !ended;
+    }
+
+    static int listenOn(const string& socketPath)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            cerr << "socket path too long: " << socketPath << '\n';
+            return -1;
+        }
+        memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        unlink(socketPath.c_str()); // Left over by a previous run
+        if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 64) != 0) {
+            cerr << "cannot listen on " << socketPath << ": " << strerror(errno) << '\n';
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+public:
+    Watcher(string path, unsigned threads, StatMode statMode, chrono::milliseconds quiet = chrono::milliseconds(20))
+        : base(move(path)), threads(threads), statMode(statMode), quiet(quiet) {}
+
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+    ~Watcher()
+    {
+        if (inotifyFd >= 0)
+            close(inotifyFd);
+    }
+
+    // Walk, then follow changes until SIGINT or SIGTERM. A line with the root
+    // total goes to out after the walk and after every batch of changes.
+    int run(const string& socketPath, ostream& out)
+    {
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0) {
+            cerr << "cannot start inotify: " << strerror(errno) << '\n';
+            return 1;
+        }
+        int listenFd = -1;
+        if (!socketPath.empty() && (listenFd = listenOn(socketPath)) < 0)
+            return 1;
+        stopRequested = 0;
+        struct sigaction action{};
+        action.sa_handler = [](int) { stopRequested = 1; };
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+
+        auto reportTotal = [this, &out] {
+            out << "total: " << sizeStr(root->getTotal()) << " (" << root->getFileCount() << " files)" << endl;
+        };
+        rescan();
+        reportTotal();
+
+        vector<Event> events;
+        unordered_map<int, string> clients; // Client fd -> partial request
+        auto lastEvent = chrono::steady_clock::now(), firstEvent = lastEvent;
+        while (!stopRequested)
+        {
+            vector<pollfd> fds{{inotifyFd, POLLIN, 0}};
+            if (listenFd >= 0)
+                fds.push_back({listenFd, POLLIN, 0});
+            for (auto& [fd, pending] : clients)
+                fds.push_back({fd, POLLIN, 0});
+
+            // Wait for quiet before applying a batch, but never hold one back for more than 10 windows
+            int timeout = -1;
+            if (!events.empty()) {
+                auto now = chrono::steady_clock::now();
+                auto deadline = min(lastEvent + quiet, firstEvent + 10 * quiet);
+                timeout = (int)max<long long>(0, chrono::duration_cast<chrono::milliseconds>(deadline - now).count());
+            }
+            if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR)
+                break;
+
+            if (fds[0].revents & POLLIN) {
+                if (events.empty())
+                    firstEvent = chrono::steady_clock::now();
+                readEvents(events);
+                lastEvent = chrono::steady_clock::now();
+            }
+            for (size_t i = 1; i < fds.size(); ++i)
+            {
+                if (!fds[i].revents)
+                    continue;
+                if (fds[i].fd == listenFd) {
+                    int client;
+                    while ((client = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                        clients[client];
+                } else if (!serve(fds[i].fd, clients[fds[i].fd])) {
+                    close(fds[i].fd);
+                    clients.erase(fds[i].fd);
+                }
+            }
+
+            auto now = chrono::steady_clock::now();
+            if (!events.empty() && (now >= lastEvent + quiet || now >= firstEvent + 10 * quiet)) {
+                applyBatch(events);
+                events.clear();
+                reportTotal();
+            }
+        }
+
+        for (auto& [fd, pending] : clients)
+            close(fd);
+        if (listenFd >= 0) {
+            close(listenFd);
+            unlink(socketPath.c_str());
+        }
+        return 0;
+    }
+};
+
+// Content hashing
+// Xxh64: streaming XXH64, the 64-bit xxHash. Fast enough to keep up with the disk
+// and needs no dependency; it is not cryptographic, duplicates are found by hash.
+class Xxh64
+{
+    static constexpr uint64_t prime1 = 11400714785074694791ull, prime2 = 14029467366897019727ull,
+        prime3 = 1609587929392839161ull, prime4 = 9650029242287828579ull, prime5 = 2870177450012600261ull;
+
+    uint64_t lanes[4];
+    unsigned char buffer[32];
+    size_t buffered = 0;
+    uint64_t length = 0;
+
+    static uint64_t read64(const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+    static uint32_t read32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+    static uint64_t round(uint64_t lane, uint64_t input) { return rotl(lane + input * prime2, 31) * prime1; }
+    static uint64_t merge(uint64_t hash, uint64_t lane) { return (hash ^ round(0, lane)) * prime1 + prime4; }
+
+    void stripe(const unsigned char* p)
+    {
+        for (int i = 0; i < 4; ++i)
+            lanes[i] = round(lanes[i], read64(p + 8 * i));
+    }
+
+public:
+    explicit Xxh64(uint64_t seed = 0) : lanes{seed + prime1 + prime2, seed + prime2, seed, seed - prime1} {}
+
+    void update(const void* data, size_t size)
+    {
+        auto* p = static_cast<const unsigned char*>(data);
+        length += size;
+        if (buffered + size < 32) {
+            memcpy(buffer + buffered, p, size);
+            buffered += size;
+            return;
+        }
+        if (buffered) {
+            size_t fill = 32 - buffered;
+            memcpy(buffer + buffered, p, fill);
+            stripe(buffer);
+            p += fill;
+            size -= fill;
+            buffered = 0;
+        }
+        for (; size >= 32; p += 32, size -= 32)
+            stripe(p);
+        memcpy(buffer, p, size);
+        buffered = size;
+    }
+
+    uint64_t digest() const
+    {
+        uint64_t hash;
+        if (length >= 32) {
+            hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+            for (uint64_t lane : lanes)
+                hash = merge(hash, lane);
+        } else {
+            hash = lanes[2] + prime5; // lanes[2] is still the seed
+        }
+        hash += length;
+        const unsigned char* p = buffer;
+        size_t left = buffered;
+        for (; left >= 8; p += 8, left -= 8)
+            hash = rotl(hash ^ round(0, read64(p)), 27) * prime1 + prime4;
+        if (left >= 4) {
+            hash = rotl(hash ^ (read32(p) * prime1), 23) * prime2 + prime3;
+            p += 4;
+            left -= 4;
+        }
+        for (; left > 0; ++p, --left)
+            hash = rotl(hash ^ (*p * prime5), 11) * prime1;
+        hash ^= hash >> 33;
+        hash *= prime2;
+        hash ^= hash >> 29;
+        hash *= prime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+};
+
+// Duplicate files
+// Finding duplicates is staged so that each stage reads as little as possible:
+// files are grouped by exact size, files sharing a size have their first 4 KiB
+// hashed, and only files still sharing size and head hash are hashed in full
+// (a file no larger than the head is already fully hashed). A 64-bit hash can
+// still collide, so the files of each set are finally compared byte for byte
+// with the first copy, and a set splits if they differ. Reads run as pool tasks,
+// so at most two files per worker are open at a time.
+class DuplicateFinder
+{
+public:
+    struct Set
+    {
+        uint64_t bytes;           // Size of each copy
+        vector<const File*> files;
+        uint64_t wasted() const { return bytes * (files.size() - 1); }
+    };
+
+    static constexpr size_t headBytes = 4096;
+
+private:
+    struct Candidate
+    {
+        const File* file;
+        uint64_t bytes;
+        uint64_t hash = 0;
+        bool readable = true;
+    };
+
+    string base;
+    WorkStealingPool pool;
+    size_t hashedHeads = 0, hashedFully = 0;
+    atomic<size_t> compared{0};
+
+    // Open a file below base for reading, -1 with a message if it cannot be
+    int openFile(const File& file, uint64_t bytes) const
+    {
+        string path = base + fullPath(file);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) {
+            cerr << "cannot open " << path << ": " << strerror(errno) << '\n';
+            return -1;
+        }
+        if (bytes > headBytes)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        return fd;
+    }
+
+    // Read up to size bytes, fewer only at the end of the file or on an error
+    static size_t readFully(int fd, char* data, size_t size)
+    {
+        size_t done = 0;
+        while (done < size)
+        {
+            ssize_t n = read(fd, data + done, size - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            done += n;
+        }
+        return done;
+    }
+
+    // Hash up to limit bytes of the file, nullopt if it cannot be read
+    optional<uint64_t> hashFile(const File& file, uint64_t limit) const
+    {
+        int fd = openFile(file, limit);
+        if (fd < 0)
+            return nullopt;
+        static thread_local vector<char> buffer(1 << 20);
+        Xxh64 hash;
+        uint64_t done = 0;
+        while (done < limit)
+        {
+            ssize_t n = read(fd, buffer.data(), min<uint64_t>(buffer.size(), limit - done));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            hash.update(buffer.data(), n);
+            done += n;
+        }
+        close(fd);
+        return hash.digest();
+    }
+
+    // Whether two files of bytes bytes have the same content, false if either cannot be read
+    bool sameContent(const File& a, const File& b, uint64_t bytes) const
+    {
+        int fdA = openFile(a, bytes);
+        if (fdA < 0)
+            return false;
+        int fdB = openFile(b, bytes);
+        if (fdB < 0) {
+            close(fdA);
+            return false;
+        }
+        static thread_local vector<char> bufferA(1 << 19), bufferB(1 << 19);
+        bool same = true;
+        for (uint64_t done = 0; same && done < bytes;)
+        {
+            size_t chunk = min<uint64_t>(bufferA.size(), bytes - done);
+            same = readFully(fdA, bufferA.data(), chunk) == chunk && readFully(fdB, bufferB.data(), chunk) == chunk
+                   && memcmp(bufferA.data(), bufferB.data(), chunk) == 0;
+            done += chunk;
+        }
+        close(fdA);
+        close(fdB);
+        return same;
+    }
+
+    // Split a set whose files share size and hash into the groups that really are
+    // equal, each compared against its first file. Groups of one are dropped.
+    vector<Set> verify(const Set& set)
+    {
+        vector<Set> groups;
+        for (const File* file : set.files)
+        {
+            compared.fetch_add(1, memory_order_relaxed);
+            auto group = ranges::find_if(groups, [&](const Set& g) { return sameContent(*g.files.front(), *file, set.bytes); });
+            if (group != groups.end())
+                group->files.push_back(file);
+            else
+                groups.push_back({set.bytes, {file}});
+        }
+        erase_if(groups, [](const Set& g) { return g.files.size() < 2; });
+        return groups;
+    }
+
+    // Hash every candidate in parallel, one pool task per file
+    void hashAll(vector<Candidate>& candidates, bool full)
+    {
+        pool.run([&] {
+            for (auto& candidate : candidates)
+                pool.spawn([this, &candidate, full] {
+                    auto hash = hashFile(*candidate.file, full ? candidate.bytes : min<uint64_t>(candidate.bytes, headBytes));
+                    candidate.readable = hash.has_value();
+                    candidate.hash = hash.value_or(0);
+                });
+        });
+    }
+
+    // Keep the candidates that share (bytes, hash) with another one, grouped together
+    static vector<Candidate> keepShared(vector<Candidate> candidates)
+    {
+        erase_if(candidates, [](const Candidate& c) { return !c.readable; });
+        ranges::sort(candidates, [](const Candidate& a, const Candidate& b) {
+            return tie(a.bytes, a.hash) < tie(b.bytes, b.hash);
+        });
+        vector<Candidate> kept;
+        for (size_t i = 0, j; i < candidates.size(); i = j)
+        {
+            for (j = i + 1; j < candidates.size() && candidates[j].bytes == candidates[i].bytes
+                 && candidates[j].hash == candidates[i].hash; ++j) {}
+            if (j - i > 1)
+                kept.insert(kept.end(), candidates.begin() + i, candidates.begin() + j);
+        }
+        return kept;
+    }
+
+public:
+    DuplicateFinder(string base, unsigned threads) : base(move(base)), pool(threads) {}
+
+    // Duplicate sets below root, most wasted bytes first. Empty files are skipped,
+    // and so are symlinks, devices, FIFOs and sockets, whose content is not theirs.
+    vector<Set> find(const Directory& root)
+    {
+        vector<Candidate> candidates;
+        for (Node& node : root.descendants())
+            if (node.kind() == NodeKind::File) {
+                auto& file = static_cast<File&>(node);
+                auto bytes = (uint64_t)llround(file.getSize() * 1024); // Walked sizes are bytes / 1024
+                if (bytes > 0 && file.isRegular())
+                    candidates.push_back({&file, bytes});
+            }
+
+        // Stage 1: sizes, all hashes are still 0
+        candidates = keepShared(move(candidates));
+        // Stage 2: first 4 KiB
+        hashedHeads = candidates.size();
+        hashAll(candidates, false);
+        candidates = keepShared(move(candidates));
+        // Stage 3: whole content, only for files longer than the head
+        vector<Candidate> longer;
+        erase_if(candidates, [&longer](const Candidate& c) {
+            if (c.bytes <= headBytes)
+                return false;
+            longer.push_back(c);
+            return true;
+        });
+        hashedFully = longer.size();
+        hashAll(longer, true);
+        longer = keepShared(move(longer));
+        candidates.insert(candidates.end(), longer.begin(), longer.end());
+        ranges::sort(candidates, [](const Candidate& a, const Candidate& b) {
+            return tie(a.bytes, a.hash) < tie(b.bytes, b.hash);
+        });
+
+        vector<Set> hashed;
+        for (size_t i = 0; i < candidates.size(); ++i)
+        {
+            if (i == 0 || candidates[i].bytes != candidates[i - 1].bytes || candidates[i].hash != candidates[i - 1].hash)
+                hashed.push_back({candidates[i].bytes, {}});
+            hashed.back().files.push_back(candidates[i].file);
+        }
+        // Stage 4: byte for byte, one pool task per set
+        vector<vector<Set>> verified(hashed.size());
+        pool.run([&] {
+            for (size_t i = 0; i < hashed.size(); ++i)
+                pool.spawn([this, &hashed, &verified, i] { verified[i] = verify(hashed[i]); });
+        });
+        vector<Set> sets;
+        for (auto& groups : verified)
+            sets.insert(sets.end(), make_move_iterator(groups.begin()), make_move_iterator(groups.end()));
+        for (auto& set : sets)
+            ranges::sort(set.files, {}, [](const File* file) { return fullPath(*file); });
+        ranges::stable_sort(sets, greater<>(), &Set::wasted);
+        return sets;
+    }
+
+    size_t headsHashed() const { return hashedHeads; }
+    size_t filesHashedFully() const { return hashedFully; }
+    size_t filesCompared() const { return compared.load(); }
+};
+
+// Print duplicate sets: "wasted<TAB>copies x size" and one indented path per copy.
+// Sizes are exact byte counts: a KB figure would show small files as 0.
+void printDuplicates(const vector<DuplicateFinder::Set>& sets, ostream& out)
+{
+    uint64_t wasted = 0;
+    for (const auto& set : sets)
+    {
+        wasted += set.wasted();
+        out << set.wasted() << " bytes wasted\t" << set.files.size() << " x " << set.bytes << " bytes\n";
+        for (const File* file : set.files)
+            out << "  " << fullPath(*file) << '\n';
+    }
+    out << "total wasted: " << wasted << " bytes in " << sets.size() << " sets\n";
+}
+
+// Benchmark: walk a synthetic tree on tmpfs once per StatMode
+int benchStat(size_t files, const string& base, unsigned threads)
+{
+    const size_t perDirectory = 1000;
+    string top = base + "/dirwalker-bench-" + to_string(getpid());
+    mkdir(top.c_str(), 0755);
+    for (size_t i = 0; i < files; ++i)
+    {
+        string dir = top + "/d" + to_string(i / perDirectory);
+        if (i % perDirectory == 0)
+            mkdir(dir.c_str(), 0755);
+        string file = dir + "/f" + to_string(i % perDirectory) + ".dat";
+        int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            cerr << "cannot create " << file << ": " << strerror(errno) << '\n';
+            filesystem::remove_all(top);
+            return 1;
+        }
+        if (ftruncate(fd, (off_t)(i % 8192)) != 0)
+            cerr << "cannot resize " << file << '\n';
+        close(fd);
+    }
+
+    cout << "files: " << files << " in " << top << '\n';
+    vector<double> totals;
+    for (auto [mode, name] : {pair{StatMode::Uring, "io_uring"}, pair{StatMode::Threads, "threads"}})
+    {
+        if (mode == StatMode::Uring && !UringStatx::forThread())
+            cout << "io_uring unavailable, this run falls back to threads\n";
+        auto start = chrono::steady_clock::now();
+        FilesystemWalker walker(threads, mode);
+        auto root = walker.walk(top);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        SizeVisitor sizeVisitor;
+        root->accept(sizeVisitor);
+        totals.push_back(sizeVisitor.getTotal());
+        cout << name << ": " << fixed << setprecision(3) << elapsed.count() << " s, "
+             << setprecision(0) << files / max(elapsed.count(), 1e-9) << " files/s\n";
+    }
+    filesystem::remove_all(top);
+    return totals.front() == totals.back() ? 0 : 1;
+}
+
+// Random tree with about files/16 directories and sizes with one decimal, for benchmarks
+shared_ptr<Directory> makeSyntheticTree(size_t files, unsigned seed)
+{
+    mt19937_64 rng(seed);
+    auto root = make_shared<Directory>("");
+    vector<Directory*> dirs{root.get()};
+    for (size_t d = 1; d <= files / 16; ++d)
+    {
+        auto dir = make_shared<Directory>("d" + to_string(d));
+        dirs[rng() % dirs.size()]->addChild(dir);
+        dirs.push_back(dir.get());
+    }
+
+    const char* extensions[] = {"txt", "cpp", "log", "bin", ""};
+    const char* owners[] = {"alice", "bob", "root"};
+    for (size_t f = 0; f < files; ++f)
+    {
+        auto props = FilePropertiesFactory::get(extensions[rng() % 5], rng() % 2, owners[rng() % 3], "staff");
+        double size = (double)(rng() % 100000) / 10;
+        dirs[rng() % dirs.size()]->addChild(make_shared<File>("f" + to_string(f), size, move(props)));
+    }
+    return root;
+}
+
+// Benchmark: serial SizeVisitor against ParallelSizeVisitor and the cached root total
+int benchSize(size_t files, unsigned threads)
+{
+    auto root = makeSyntheticTree(files, 2025);
+
+    auto start = chrono::steady_clock::now();
+    SizeVisitor serial;
+    root->accept(serial);
+    chrono::duration<double> serialTime = chrono::steady_clock::now() - start;
+
+    WorkStealingPool pool(threads);
+    start = chrono::steady_clock::now();
+    ParallelSizeVisitor parallel(pool);
+    parallel.visit(*root);
+    chrono::duration<double> parallelTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    double cached = root->getTotal();
+    chrono::duration<double> cachedTime = chrono::steady_clock::now() - start;
+
+    cout << "files: " << files << ", threads: " << threads << '\n'
+         << "serial:   " << fixed << setprecision(3) << serialTime.count() << " s, total " << sizeStr(serial.getTotal()) << '\n'
+         << "parallel: " << fixed << setprecision(3) << parallelTime.count() << " s, total " << sizeStr(parallel.getTotal()) << '\n'
+         << "cached:   " << fixed << setprecision(3) << cachedTime.count() << " s, total " << sizeStr(cached) << '\n';
+    return serial.getTotal() == parallel.getTotal() && serial.getTotal() == cached ? 0 : 1;
+}
+
+// Command input
+// readCommands parses "N" followed by N commands and hands them to a builder:
+//   DIR id [parentId] name                    builder.addDirectory(id, parentId, name)
+//   FILE parentId T|F owner group size name   builder.addFile(parentId, readOnly, owner, group, size, nameExtension)
+//   RM path                                   builder.removeNode(path)
+//   MV path newPath                           builder.moveNode(path, newPath)
+//   RESIZE path size                          builder.resizeFile(path, size)
+// Paths are relative to the root, as printed by fullPath().
+template <class Builder>
+void readCommands(istream& in, Builder& builder)
+{
+    size_t N;
+    if (!(in >> N))
+        return;
+
+    string operation;
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        in >> operation;
+        if (operation == "DIR") {
+            long long id;
+            string name;
+            string maybeParent;
+
+            in >> id;
+
+            getline(in, maybeParent); // Read rest of line
+
+            stringstream stringS(maybeParent);
+            long long parentId = 0;
+
+            if (!(stringS >> name)) continue; // Skip if no name
+                string remain;
+            if (stringS >> remain) { // If parent ID was provided
+                parentId = stoll(name);
+                name = remain;
+            }
+
+            builder.addDirectory(id, parentId, name);
+        } else if (operation == "FILE") {
+            long long parentId;
+            string readOnlyString, owner, group, nameExtension;
+            double size;
+
+            in >> parentId >> readOnlyString >> owner >> group >> size >> nameExtension;
+
+            bool readOnly = (readOnlyString == "T");
+
+            builder.addFile(parentId, readOnly, owner, group, size, nameExtension);
+        } else if (operation == "RM") {
+            string path;
+            in >> path;
+            builder.removeNode(path);
+        } else if (operation == "MV") {
+            string path, newPath;
+            in >> path >> newPath;
+            builder.moveNode(path, newPath);
+        } else if (operation == "RESIZE") {
+            string path;
+            double size;
+            in >> path >> size;
+            builder.resizeFile(path, size);
+        }
+    }
+}
+
+// Zero-copy command input
+// InputBuffer maps the whole input (or reads it in large blocks when it is a pipe)
+// and CommandTokenizer cuts it into string_view tokens, so parsing a line makes no
+// temporary strings: names reach the builders as views into the buffer and are
+// only copied once, into the node that keeps them.
+class InputBuffer
+{
+    void* mapped = MAP_FAILED;
+    size_t length = 0;
+    string owned; // Used when the input cannot be mapped
+
+public:
+    // Take the contents of an open file descriptor
+    explicit InputBuffer(int fd)
+    {
+        struct stat info{};
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                length = info.st_size;
+                madvise(mapped, length, MADV_SEQUENTIAL);
+                return;
+            }
+        }
+        const size_t block = 1 << 20;
+        for (;;)
+        {
+            size_t used = owned.size();
+            owned.resize(used + block);
+            ssize_t n = read(fd, owned.data() + used, block);
+            owned.resize(used + max<ssize_t>(n, 0));
+            if (n <= 0)
+                break;
+        }
+    }
+    InputBuffer(const InputBuffer&) = delete;
+    InputBuffer& operator=(const InputBuffer&) = delete;
+    ~InputBuffer()
+    {
+        if (mapped != MAP_FAILED)
+            munmap(mapped, length);
+    }
+
+    string_view text() const
+    {
+        return mapped != MAP_FAILED ? string_view(static_cast<const char*>(mapped), length) : string_view(owned);
+    }
+};
+
+class CommandTokenizer
+{
+    string_view text;
+    size_t position = 0;
+
+    static bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+
+public:
+    explicit CommandTokenizer(string_view text) : text(text) {}
+
+    // Next whitespace-separated token, empty at the end of the input (like cin >> word)
+    string_view token()
+    {
+        while (position < text.size() && isSpace(text[position]))
+            ++position;
+        size_t start = position;
+        while (position < text.size() && !isSpace(text[position]))
+            ++position;
+        return text.substr(start, position - start);
+    }
+
+    // The rest of the current line, the newline is consumed (like getline)
+    string_view restOfLine()
+    {
+        size_t end = text.find('\n', position);
+        if (end == string_view::npos)
+            end = text.size();
+        string_view rest = text.substr(position, end - position);
+        position = min(end + 1, text.size());
+        return rest;
+    }
+
+    // Number of lines in the whole input, for throughput reports
+    size_t lineCount() const { return (size_t)count(text.begin(), text.end(), '\n'); }
+};
+
+// Parse a whole token as a number, false if it is not one. Like the stream
+// parser, a leading '+' is allowed and "inf" or "nan" are not numbers; value is
+// left alone unless a finite number was read.
+template <class T>
+bool parseNumber(string_view token, T& value)
+{
+    if (token.size() > 1 && token[0] == '+' && token[1] != '-')
+        token.remove_prefix(1);
+    T parsed;
+    auto [end, error] = from_chars(token.data(), token.data() + token.size(), parsed);
+    if (error != errc())
+        return false;
+    if constexpr (is_floating_point_v<T>)
+        if (!isfinite(parsed))
+            return false;
+    value = parsed;
+    return end == token.data() + token.size();
+}
+
+// Same commands and builder calls as readCommands(istream&), over an in-memory buffer
+template <class Builder>
+void readCommands(string_view text, Builder& builder)
+{
+    CommandTokenizer in(text);
+    size_t N;
+    if (!parseNumber(in.token(), N))
+        return;
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        string_view operation = in.token();
+        if (operation.empty())
+            break; // Input ended early
+        if (operation == "DIR") {
+            long long id = 0;
+            parseNumber(in.token(), id);
+
+            // The rest of the line is "name" or "parentId name"
+            CommandTokenizer rest(in.restOfLine());
+            string_view name = rest.token();
+            if (name.empty()) continue; // Skip if no name
+            long long parentId = 0;
+            string_view remain = rest.token();
+            if (!remain.empty()) { // If parent ID was provided
+                parseNumber(name, parentId);
+                name = remain;
+            }
+
+            builder.addDirectory(id, parentId, name);
+        } else if (operation == "FILE") {
+            long long parentId = 0;
+            double size = 0;
+            parseNumber(in.token(), parentId);
+            string_view readOnlyString = in.token();
+            string_view owner = in.token();
+            string_view group = in.token();
+            parseNumber(in.token(), size);
+            string_view nameExtension = in.token();
+            if (nameExtension.empty())
+                break;
+
+            builder.addFile(parentId, readOnlyString == "T", owner, group, size, nameExtension);
+        } else if (operation == "RM") {
+            string_view path = in.token();
+            if (path.empty())
+                break;
+            builder.removeNode(path);
+        } else if (operation == "MV") {
+            string_view path = in.token();
+            string_view newPath = in.token();
+            if (newPath.empty())
+                break;
+            builder.moveNode(path, newPath);
+        } else if (operation == "RESIZE") {
+            string_view path = in.token();
+            double size = 0;
+            string_view sizeToken = in.token();
+            if (sizeToken.empty())
+                break;
+            parseNumber(sizeToken, size);
+            builder.resizeFile(path, size);
+        }
+    }
+}
+
+// Binary snapshot
+// A snapshot is the FrozenTree arrays written back to back after a small header,
+// each section padded to 8 bytes, followed by the distinct FileProperties as
+// strings. Loading maps the file and points the tree's spans into the mapping;
+// only the flyweight table is parsed, and it is re-interned through the factory.
+// Files are native-endian and trusted: only their shape is checked.
+struct SnapshotHeader
+{
+    static constexpr array<char, 8> expectedMagic{'D', 'W', 'S', 'N', 'A', 'P', '0', '3'};
+
+    array<char, 8> magic = expectedMagic;
+    uint32_t nodes = 0;
+    uint32_t properties = 0;
+    uint64_t nameBytes = 0;
+    uint64_t propertyBytes = 0; // Size of the property records
+};
+
+// Property record: readOnly byte, three 32-bit lengths, then extension, owner and group
+constexpr size_t propertyRecordHeader = 1 + 3 * sizeof(uint32_t);
+
+constexpr size_t padTo8(size_t n) { return (n + 7) & ~size_t(7); }
+
+FrozenTree::FrozenTree() = default;
+FrozenTree::FrozenTree(FrozenTree&&) noexcept = default;
+FrozenTree& FrozenTree::operator=(FrozenTree&&) noexcept = default;
+FrozenTree::~FrozenTree() = default;
+
+bool FrozenTree::save(const string& path) const
+{
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) {
+        cerr << "cannot create " << path << ": " << strerror(errno) << '\n';
+        return false;
+    }
+    auto write = [&out](const void* data, size_t bytes) {
+        static constexpr char zeros[8] = {};
+        out.write(static_cast<const char*>(data), bytes);
+        out.write(zeros, padTo8(bytes) - bytes);
+    };
+    auto writeSpan = [&write](auto values) { write(values.data(), values.size_bytes()); };
+
+    SnapshotHeader header;
+    header.nodes = size();
+    header.properties = (uint32_t)properties.size();
+    header.nameBytes = names.size();
+    for (const FileProperties* props : properties)
+        header.propertyBytes += propertyRecordHeader + props->extension.size() + props->owner.size() + props->group.size();
+
+    write(&header, sizeof(header));
+    writeSpan(sizes);
+    writeSpan(hashes);
+    writeSpan(propsIndex);
+    writeSpan(subtreeEnd);
+    writeSpan(childBegin);
+    writeSpan(childIndex);
+    writeSpan(nameBegin);
+    write(names.data(), names.size());
+    for (const FileProperties* props : properties)
+    {
+        uint32_t lengths[3] = {(uint32_t)props->extension.size(), (uint32_t)props->owner.size(), (uint32_t)props->group.size()};
+        out.put(props->readOnly ? 1 : 0);
+        out.write(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+        out << props->extension << props->owner << props->group;
+    }
+    if (!out.flush()) {
+        cerr << "cannot write " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+optional<FrozenTree> FrozenTree::load(const string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        cerr << "cannot open " << path << ": " << strerror(errno) << '\n';
+        return nullopt;
+    }
+    FrozenTree tree;
+    tree.mapping = make_unique<InputBuffer>(fd);
+    close(fd);
+    string_view file = tree.mapping->text();
+
+    auto invalid = [&path] {
+        cerr << "not a snapshot: " << path << '\n';
+        return nullopt;
+    };
+    SnapshotHeader header;
+    if (file.size() < sizeof(header))
+        return invalid();
+    memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != SnapshotHeader::expectedMagic || header.nodes == 0)
+        return invalid();
+
+    // Carve the sections in the order save() wrote them
+    size_t offset = sizeof(header);
+    bool fits = true;
+    auto section = [&](size_t bytes) {
+        const char* begin = file.data() + offset;
+        fits = fits && bytes <= file.size() - min(offset, file.size());
+        offset += padTo8(bytes);
+        return begin;
+    };
+    auto sectionOf = [&]<class T>(span<const T>& values, size_t count) {
+        const char* begin = section(count * sizeof(T));
+        if (fits)
+            values = span<const T>(reinterpret_cast<const T*>(begin), count);
+    };
+    size_t n = header.nodes;
+    sectionOf(tree.sizes, n);
+    sectionOf(tree.hashes, n);
+    sectionOf(tree.propsIndex, n);
+    sectionOf(tree.subtreeEnd, n);
+    sectionOf(tree.childBegin, n + 1);
+    sectionOf(tree.childIndex, n - 1);
+    sectionOf(tree.nameBegin, n + 1);
+    const char* names = section(header.nameBytes);
+    const char* records = section(header.propertyBytes);
+    if (!fits || tree.childBegin[n] != n - 1 || tree.nameBegin[n] != header.nameBytes)
+        return invalid();
+    tree.names = string_view(names, header.nameBytes);
+
+    // The flyweight table is tiny next to the nodes: intern it again
+    string_view rest(records, header.propertyBytes);
+    for (uint32_t i = 0; i < header.properties; ++i)
+    {
+        uint32_t lengths[3];
+        if (rest.size() < propertyRecordHeader)
+            return invalid();
+        bool readOnly = rest[0] != 0;
+        memcpy(lengths, rest.data() + 1, sizeof(lengths));
+        rest.remove_prefix(propertyRecordHeader);
+        if ((size_t)lengths[0] + lengths[1] + lengths[2] > rest.size())
+            return invalid();
+        string_view extension = rest.substr(0, lengths[0]);
+        string_view owner = rest.substr(lengths[0], lengths[1]);
+        string_view group = rest.substr(lengths[0] + lengths[1], lengths[2]);
+        rest.remove_prefix(lengths[0] + lengths[1] + lengths[2]);
+        tree.properties.push_back(FilePropertiesFactory::intern(extension, readOnly, owner, group).get());
+    }
+    return tree;
+}
+
+vector<uint64_t> FrozenTree::hashNodes() const
+{
+    vector<uint64_t> propsHashes;
+    for (const FileProperties* props : properties)
+    {
+        Xxh64 hash;
+        for (const string* text : {&props->extension, &props->owner, &props->group})
+        {
+            uint64_t length = text->size();
+            hash.update(&length, sizeof(length));
+            hash.update(text->data(), text->size());
+        }
+        hash.update(&props->readOnly, sizeof(props->readOnly));
+        propsHashes.push_back(hash.digest());
+    }
+
+    // Preorder puts children after their parent, so a backward pass sees them first.
+    // Children are combined by sum: sibling order does not change a hash.
+    vector<uint64_t> result(size());
+    for (uint32_t i = size(); i-- > 0;)
+    {
+        Xxh64 hash;
+        string_view nodeName = name(i);
+        uint64_t length = nodeName.size();
+        hash.update(&length, sizeof(length));
+        hash.update(nodeName.data(), nodeName.size());
+        if (isDirectory(i)) {
+            uint64_t children = 0;
+            for (uint32_t child : this->children(i))
+                children += result[child];
+            hash.update("D", 1);
+            hash.update(&children, sizeof(children));
+        } else {
+            hash.update("F", 1);
+            double size = sizes[i] + 0.0; // -0 and 0 hash alike
+            hash.update(&size, sizeof(size));
+            hash.update(&propsHashes[propsIndex[i]], sizeof(uint64_t));
+        }
+        result[i] = hash.digest();
+    }
+    return result;
+}
+
+// Snapshot diff
+// Compare two trees from the root down, skipping every subtree whose Merkle hash
+// did not change, so the work follows the size of the change rather than of the
+// trees. Children are matched by name, which is unique in a real directory.
+// Prints "+ path", "- path" or "~ path" with sizes; returns the number of lines.
+size_t diffTrees(const FrozenTree& before, const FrozenTree& after, ostream& out)
+{
+    size_t changes = 0;
+    auto entry = [&](char mark, const FrozenTree& tree, uint32_t node, const string& path) {
+        ++changes;
+        out << mark << ' ' << path << (tree.isDirectory(node) ? "/ (" : " (")
+            << sizeStr(tree.subtreeSize(node).value()) << ")\n";
+    };
+
+    vector<tuple<uint32_t, uint32_t, string>> stack{{FrozenTree::root, FrozenTree::root, ""}};
+    while (!stack.empty())
+    {
+        auto [a, b, path] = move(stack.back());
+        stack.pop_back();
+        if (before.hash(a) == after.hash(b))
+            continue;
+
+        unordered_map<string_view, uint32_t> added;
+        for (uint32_t child : after.children(b))
+            added.emplace(after.name(child), child);
+        for (uint32_t child : before.children(a))
+        {
+            string childPath = path + '/' + string(before.name(child));
+            auto match = added.find(before.name(child));
+            if (match == added.end()) {
+                entry('-', before, child, childPath);
+                continue;
+            }
+            uint32_t other = match->second;
+            added.erase(match);
+            if (before.hash(child) == after.hash(other))
+                continue;
+            if (before.isDirectory(child) && after.isDirectory(other)) {
+                stack.push_back({child, other, move(childPath)});
+            } else if (!before.isDirectory(child) && !after.isDirectory(other)) {
+                ++changes;
+                out << "~ " << childPath << " (" << sizeStr(before.sizeKB(child)) << " -> " << sizeStr(after.sizeKB(other)) << ")\n";
+            } else {
+                entry('-', before, child, childPath);
+                entry('+', after, other, childPath);
+            }
+        }
+        // What is left was not in before, report it in after's order
+        for (uint32_t child : after.children(b))
+        {
+            auto left = added.find(after.name(child));
+            if (left != added.end() && left->second == child)
+                entry('+', after, child, path + '/' + string(after.name(child)));
+        }
+    }
+    return changes;
+}
+
+// TreeBuilder: builds the shared_ptr Directory/File tree from commands
+// Directories are owned by the tree only: the ID map holds weak references, so
+// a removed directory is freed and later commands naming its ID are skipped.
+// RM, MV and RESIZE address nodes by path; the first of them builds a PathIndex,
+// which is then kept up to date.
+class TreeBuilder
+{
+    // Map from directory ID to Directory pointer, root is ID 0
+    unordered_map<long long, weak_ptr<Directory>> dirs;
+    shared_ptr<Directory> root = make_shared<Directory>(""); // Root has empty name
+    unique_ptr<PathIndex> index; // Filled as nodes are added once indexPaths() is called
+
+    // Live directory with this ID, nullptr if unknown or removed
+    shared_ptr<Directory> directory(long long id)
+    {
+        auto it = dirs.find(id);
+        if (it == dirs.end())
+            return nullptr;
+        shared_ptr<Directory> dir = it->second.lock();
+        if (!dir)
+            dirs.erase(it);
+        return dir;
+    }
+
+    // Node at path, the root excluded
+    Node* find(string_view path)
+    {
+        if (!index)
+            indexPaths();
+        Node* node = index->find(path);
+        return node == root.get() ? nullptr : node;
+    }
+
+public:
+    TreeBuilder() { dirs[0] = root; }
+
+    const shared_ptr<Directory>& getRoot() const { return root; }
+
+    // Keep a PathIndex up to date with the tree from now on
+    void indexPaths() { index = PathIndex::build(*root); }
+    unique_ptr<PathIndex> takeIndex() { return move(index); }
+
+    void addDirectory(long long id, long long parentId, string_view name)
+    {
+        shared_ptr<Directory> parent = directory(parentId);
+        if (!parent)
+            return; // Unknown parent, skip the command
+        auto dir = make_shared<Directory>(string(name));
+        parent->addChild(dir);
+        if (index)
+            index->add(*dir);
+        dirs[id] = dir;
+    }
+
+    void addFile(long long parentId, bool readOnly, string_view owner, string_view group,
+                 double size, string_view nameExtension)
+    {
+        shared_ptr<Directory> parent = directory(parentId);
+        if (!parent)
+            return;
+        // Get shared properties object
+        auto props = FilePropertiesFactory::get(extensionOf(nameExtension), readOnly, owner, group);
+        auto file = make_shared<File>(string(nameExtension), size, move(props));
+        parent->addChild(file);
+        if (index)
+            index->add(*file);
+    }
+
+    // Delete a file or a whole subtree
+    void removeNode(string_view path)
+    {
+        Node* node = find(path);
+        if (!node)
+            return;
+        index->removeSubtree(*node);
+        node->getParent()->removeChild(*node); // The subtree dies here
+    }
+
+    // Move and/or rename. Moving onto a directory puts the node inside it, moving
+    // onto a file replaces the file, and so does moving into a directory that has
+    // a file of that name. A directory is never replaced, and cannot move into its
+    // own subtree. A renamed file takes the properties of its new extension.
+    void moveNode(string_view path, string_view newPath)
+    {
+        Node* node = find(path);
+        if (!node)
+            return;
+        while (newPath.size() > 1 && newPath.back() == '/')
+            newPath.remove_suffix(1);
+
+        Node* target = index->find(newPath);
+        Directory* newParent;
+        string_view newName = node->getName();
+        if (target && target->isDirectory()) {
+            newParent = static_cast<Directory*>(target);
+        } else {
+            size_t slash = newPath.rfind('/');
+            Node* parent = index->find(slash == string_view::npos ? "" : newPath.substr(0, slash));
+            if (!parent || !parent->isDirectory())
+                return;
+            newParent = static_cast<Directory*>(parent);
+            newName = newPath.substr(slash == string_view::npos ? 0 : slash + 1);
+            if (newName.empty() || newName == ".")
+                return;
+        }
+        for (Directory* dir = newParent; dir; dir = dir->getParent())
+            if (dir == node)
+                return;
+        Node* replaced = index->child(*newParent, newName);
+        if (replaced == node || (replaced && replaced->isDirectory()))
+            return;
+
+        string name(newName);
+        if (replaced) {
+            index->remove(*replaced);
+            newParent->removeChild(*replaced);
+        }
+        index->remove(*node);
+        shared_ptr<Node> moved = node->getParent()->removeChild(*node);
+        if (moved->kind() == NodeKind::File && extensionOf(name) != extensionOf(moved->getName())) {
+            auto& file = static_cast<File&>(*moved);
+            const FileProperties& props = *file.getProps();
+            file.setProps(FilePropertiesFactory::get(extensionOf(name), props.readOnly, props.owner, props.group));
+        }
+        moved->setName(move(name));
+        newParent->addChild(moved);
+        index->add(*moved);
+    }
+
+    void resizeFile(string_view path, double size)
+    {
+        Node* node = find(path);
+        if (node && !node->isDirectory())
+            node->getParent()->setFileSize(static_cast<File&>(*node), size);
+    }
+};
+
+// FlatTreeBuilder: builds a FlatTree from commands, no shared_ptr involved.
+// The arena tree is append-only, so RM, MV and RESIZE are counted, not applied,
+// and the caller reports them.
+class FlatTreeBuilder
+{
+    unordered_map<long long, uint32_t> dirs{{0, FlatTree::root}};
+    FlatTree tree;
+    size_t rejected = 0;
+
+public:
+    const FlatTree& getTree() const { return tree; }
+    size_t rejectedCommands() const { return rejected; }
+
+    void addDirectory(long long id, long long parentId, string_view name)
+    {
+        auto parent = dirs.find(parentId);
+        if (parent == dirs.end())
+            return;
+        dirs[id] = tree.addDirectory(parent->second, name);
+    }
+
+    void addFile(long long parentId, bool readOnly, string_view owner, string_view group,
+                 double size, string_view nameExtension)
+    {
+        auto parent = dirs.find(parentId);
+        if (parent == dirs.end())
+            return;
+        // The factory keeps every flyweight alive, so the tree can hold plain pointers
+        const auto& props = FilePropertiesFactory::intern(extensionOf(nameExtension), readOnly, owner, group);
+        tree.addFile(parent->second, nameExtension, size, props.get());
+    }
+
+    void removeNode(string_view) { ++rejected; }
+    void moveNode(string_view, string_view) { ++rejected; }
+    void resizeFile(string_view, double) { ++rejected; }
+};
+
+// Benchmark: virtual accept() against static traverse() and the frozen tree
+int benchVisit(size_t files, int repeats)
+{
+    auto root = makeSyntheticTree(files, 2025);
+    FrozenTree frozen = FrozenTree::freeze(*root);
+
+    // Best time of repeats runs of visit(), and the total it computed
+    auto measure = [files, repeats](const char* name, auto visit) {
+        double best = 1e300, total = 0;
+        for (int r = 0; r < repeats; ++r)
+        {
+            SizeVisitor sizeVisitor;
+            auto start = chrono::steady_clock::now();
+            visit(sizeVisitor);
+            chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            best = min(best, elapsed.count());
+            total = sizeVisitor.getTotal();
+        }
+        cout << left << setw(10) << name << right << fixed << setprecision(3) << setw(9) << best * 1000 << " ms, "
+             << setprecision(1) << setw(8) << best * 1e9 / max<double>(files, 1) << " ns/file, total " << sizeStr(total) << '\n';
+        return total;
+    };
+
+    cout << "files: " << files << '\n';
+    double dynamic = measure("dynamic", [&](SizeVisitor& v) { root->accept(v); });
+    double statics = measure("static", [&](SizeVisitor& v) { traverse(*root, v); });
+    double flat = measure("frozen", [&](SizeVisitor& v) { frozen.accept(v); });
+    double iterated = measure("iterator", [&](SizeVisitor& v) {
+        for (Node& node : root->descendants())
+            if (node.kind() == NodeKind::File)
+                v.visit(static_cast<File&>(node));
+    });
+    return dynamic == statics && dynamic == flat && dynamic == iterated ? 0 : 1;
+}
+
+// Benchmark: many threads interning property sets at once
+// Every round runs the same lookups split over more threads and checks that all
+// threads got the same flyweight for the same key.
+int benchFactory(unsigned maxThreads, size_t lookups)
+{
+    // Key space: 200 extensions x 20 owners x 5 groups x read-only flag
+    auto keyOf = [](uint64_t r) {
+        return tuple<string, bool, string, string>{"ext" + to_string(r % 200), (r >> 8) & 1,
+                                                   "user" + to_string((r >> 16) % 20), "group" + to_string((r >> 24) % 5)};
+    };
+    vector<tuple<string, bool, string, string>> keys;
+    mt19937_64 rng(2025);
+    for (size_t i = 0; i < 1 << 16; ++i)
+        keys.push_back(keyOf(rng()));
+
+    bool consistent = true;
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        vector<vector<const FileProperties*>> seen(threads);
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; ++t)
+            workers.emplace_back([&, t] {
+                seen[t].reserve(lookups / threads + 1);
+                for (size_t i = t; i < lookups; i += threads)
+                {
+                    const auto& [extension, readOnly, owner, group] = keys[i % keys.size()];
+                    seen[t].push_back(FilePropertiesFactory::intern(extension, readOnly, owner, group).get());
+                }
+            });
+        for (auto& worker : workers)
+            worker.join();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        for (unsigned t = 0; t < threads; ++t)
+            for (size_t k = 0; k < seen[t].size(); ++k)
+            {
+                const auto& [extension, readOnly, owner, group] = keys[(t + k * threads) % keys.size()];
+                const FileProperties* props = seen[t][k];
+                consistent &= props->extension == extension && props->readOnly == readOnly
+                              && props->owner == owner && props->group == group;
+            }
+        cout << "threads: " << setw(3) << threads << ", " << fixed << setprecision(0)
+             << lookups / max(elapsed.count(), 1e-9) << " lookups/s, " << FilePropertiesFactory::size() << " flyweights\n";
+    }
+    return consistent ? 0 : 1;
+}
+
+// Builder that only counts commands, to time parsing on its own
+struct CountingBuilder
+{
+    size_t directories = 0, files = 0;
+    void addDirectory(long long, long long, string_view) { ++directories; }
+    void addFile(long long, bool, string_view, string_view, double, string_view) { ++files; }
+    void removeNode(string_view) {}
+    void moveNode(string_view, string_view) {}
+    void resizeFile(string_view, double) {}
+};
+
+// Benchmark: stream parsing against the zero-copy tokenizer, in lines per second
+int benchParse(const string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        cerr << "cannot open " << path << ": " << strerror(errno) << '\n';
+        return 1;
+    }
+    InputBuffer input(fd);
+    close(fd);
+    size_t lines = CommandTokenizer(input.text()).lineCount();
+
+    auto measure = [lines](const char* name, auto run) {
+        auto start = chrono::steady_clock::now();
+        run();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        cout << left << setw(18) << name << right << fixed << setprecision(3) << setw(8) << elapsed.count() << " s, "
+             << setprecision(0) << setw(10) << lines / max(elapsed.count(), 1e-9) << " lines/s\n";
+    };
+
+    cout << "lines: " << lines << '\n';
+    CountingBuilder streamCount, tokenCount;
+    measure("stream parse", [&] {
+        ifstream in(path);
+        readCommands(in, streamCount);
+    });
+    measure("zero-copy parse", [&] { readCommands(input.text(), tokenCount); });
+    measure("stream ingest", [&] {
+        ifstream in(path);
+        TreeBuilder builder;
+        readCommands(in, builder);
+    });
+    measure("zero-copy ingest", [&] {
+        TreeBuilder builder;
+        readCommands(input.text(), builder);
+    });
+    return streamCount.directories == tokenCount.directories && streamCount.files == tokenCount.files ? 0 : 1;
+}
+
+// Benchmark: freeze a synthetic tree, write it as a snapshot and map it back
+int benchSnapshot(size_t files, const string& path)
+{
+    auto root = makeSyntheticTree(files, 2025);
+    FrozenTree frozen = FrozenTree::freeze(*root);
+
+    auto measure = [](const char* name, auto run) {
+        auto start = chrono::steady_clock::now();
+        auto result = run();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        cout << left << setw(10) << name << right << fixed << setprecision(3) << setw(10) << elapsed.count() * 1000 << " ms\n";
+        return result;
+    };
+
+    cout << "files: " << files << '\n';
+    if (!measure("save", [&] { return frozen.save(path); }))
+        return 1;
+    struct stat info{};
+    stat(path.c_str(), &info);
+    cout << "snapshot: " << info.st_size << " bytes\n";
+    auto loaded = measure("load", [&] { return FrozenTree::load(path); });
+    unlink(path.c_str());
+    if (!loaded)
+        return 1;
+    double expected = measure("size", [&] {
+        SizeVisitor sizeVisitor;
+        frozen.accept(sizeVisitor);
+        return sizeVisitor.getTotal();
+    });
+    double mapped = measure("size mapped", [&] {
+        SizeVisitor sizeVisitor;
+        loaded->accept(sizeVisitor);
+        return sizeVisitor.getTotal();
+    });
+    return expected == mapped ? 0 : 1;
+}
+
+// Benchmark: GlobSizeVisitor against std::regex on every full path. The second
+// pattern matches directories only, which must not count; the third takes whole
+// subtrees from their cached totals.
+int benchGlob(size_t files)
+{
+    auto root = makeSyntheticTree(files, 2025);
+    const pair<const char*, const char*> patterns[] = {
+        {"**/d1*/f1*", "(.*/)?d1[^/]*/f1[^/]*"},
+        {"**/d1*", "(.*/)?d1[^/]*"},
+        {"**/d1*/**", "(.*/)?d1[^/]*/.*"},
+    };
+
+    auto measure = [files](const char* name, auto run) {
+        auto start = chrono::steady_clock::now();
+        auto [total, count] = run();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        cout << left << setw(8) << name << right << fixed << setprecision(3) << setw(10) << elapsed.count() * 1000 << " ms, "
+             << setprecision(1) << setw(8) << elapsed.count() * 1e9 / max<double>(files, 1) << " ns/file, "
+             << count << " files, total " << sizeStr(total) << '\n';
+        return pair(total, count);
+    };
+
+    int status = 0;
+    for (auto [glob, expression] : patterns)
+    {
+        cout << "files: " << files << ", pattern: " << glob << '\n';
+        auto regexResult = measure("regex", [&] {
+            regex pattern(expression);
+            SizeSum total;
+            size_t count = 0;
+            vector<pair<Directory*, string>> stack{{root.get(), ""}}; // Directory and its path with a trailing '/'
+            while (!stack.empty())
+            {
+                auto [dir, path] = move(stack.back());
+                stack.pop_back();
+                for (const auto& child : dir->getChildren())
+                {
+                    string childPath = path + child->getName();
+                    if (child->kind() == NodeKind::Directory) {
+                        stack.push_back({static_cast<Directory*>(child.get()), childPath + '/'});
+                    } else if (regex_match(childPath, pattern)) {
+                        total.add(static_cast<File&>(*child).getSize());
+                        ++count;
+                    }
+                }
+            }
+            return pair(total.value(), count);
+        });
+        auto globResult = measure("glob", [&] {
+            GlobFilter filter({glob});
+            GlobSizeVisitor visitor(filter);
+            visitor.visit(*root);
+            return pair(visitor.getTotal(), visitor.getFileCount());
+        });
+        if (regexResult != globResult)
+            status = 1;
+    }
+    return status;
+}
+
+// Use visitor to compute total size and print the tree structure
+void report(const shared_ptr<Directory>& root, unsigned threads)
+{
+    double total;
+    if (threads > 1) {
+        WorkStealingPool pool(threads);
+        ParallelSizeVisitor sizeVisitor(pool);
+        sizeVisitor.visit(*root);
+        total = sizeVisitor.getTotal();
+    } else {
+        SizeVisitor sizeVisitor;
+        traverse(*root, sizeVisitor);
+        total = sizeVisitor.getTotal();
+    }
+    cout << "total: " << sizeStr(total) << '\n';
 
-    // Print the tree structure
     printTree(root, "", true);
+}
+
+int main(int argc, char* argv[])
+{
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
+
+    // "--walk PATH [--threads N] [--stat uring|threads]" builds the tree from a real directory
+    // "--bench-stat [FILES] [DIR]" compares the two stat modes on a synthetic tmpfs tree
+    // "--bench-size [FILES]" compares the serial and parallel size visitors
+    // "--bench-visit [FILES] [REPEATS]" compares virtual and static visitor dispatch
+    // "--bench-factory [LOOKUPS]" stresses the flyweight factory with 1..N threads
+    // "--bench-parse FILE" times stream parsing against the zero-copy tokenizer
+    // "--bench-snapshot [FILES] [PATH]" times writing and mapping a snapshot
+    // "--input FILE" reads the commands from FILE instead of stdin
+    // "--save-snapshot FILE" writes the built tree as a binary snapshot, then reports it frozen
+    // "--snapshot FILE" reports a saved snapshot instead of building a tree
+    // "--group-by extension|owner|group" prints total size and file count per key instead of the tree
+    // "--top K" prints the K largest files and directories with their paths instead of the tree
+    // "--watch PATH [--socket PATH]" walks PATH, then keeps the tree current with inotify and
+    //   answers --lookup style queries on the Unix socket until interrupted
+    // "--dedup PATH" walks PATH and lists duplicate files by content, most wasted space first
+    // "--diff OLD NEW" prints what changed between two snapshots
+    // "--glob PATTERN" (repeatable) prints the total of the files matching any pattern instead of the tree
+    // "--bench-glob [FILES]" compares the glob DFA with std::regex on full paths
+    // "--lookup FILE" resolves the paths listed in FILE, one per line, instead of printing the tree
+    // "--threads N" also sums sizes in parallel, the default stays serial for stdin input
+    string walkPath;
+    unsigned threads = thread::hardware_concurrency();
+    bool threadsGiven = false;
+    bool flat = false;         // "--flat" builds the arena-backed FlatTree from commands instead
+    bool freeze = false;       // "--freeze" converts the built tree to a FrozenTree before reporting
+    bool flyweightStats = false; // "--flyweight-stats" writes a JSON cache summary to stderr
+    string inputPath;
+    string saveSnapshot, loadSnapshot;
+    string lookupPath;
+    string watchPath, socketPath;
+    string dedupPath;
+    vector<string> diffPaths;
+    vector<string> globs;
+    optional<GroupKey> groupBy;
+    optional<size_t> topK;
+    StatMode statMode = StatMode::Uring;
+    string bench;              // Benchmark to run instead of the normal report
+    vector<string> benchArgs;  // Positional arguments following the benchmark flag
+    for (int a = 1; a < argc; ++a)
+    {
+        string arg = argv[a];
+        if (arg == "--walk" && a + 1 < argc)
+            walkPath = argv[++a];
+        else if (arg == "--threads" && a + 1 < argc) {
+            threads = max(1, stoi(argv[++a]));
+            threadsGiven = true;
+        }
+        else if (arg == "--flat")
+            flat = true;
+        else if (arg == "--freeze")
+            freeze = true;
+        else if (arg == "--flyweight-stats")
+            flyweightStats = true;
+        else if (arg == "--input" && a + 1 < argc)
+            inputPath = argv[++a];
+        else if (arg == "--save-snapshot" && a + 1 < argc)
+            saveSnapshot = argv[++a];
+        else if (arg == "--snapshot" && a + 1 < argc)
+            loadSnapshot = argv[++a];
+        else if (arg == "--lookup" && a + 1 < argc)
+            lookupPath = argv[++a];
+        else if (arg == "--watch" && a + 1 < argc)
+            watchPath = argv[++a];
+        else if (arg == "--socket" && a + 1 < argc)
+            socketPath = argv[++a];
+        else if (arg == "--glob" && a + 1 < argc)
+            globs.push_back(argv[++a]);
+        else if (arg == "--dedup" && a + 1 < argc)
+            dedupPath = argv[++a];
+        else if (arg == "--diff" && a + 2 < argc) {
+            diffPaths = {argv[a + 1], argv[a + 2]};
+            a += 2;
+        }
+        else if (arg == "--top" && a + 1 < argc)
+            topK = stoul(argv[++a]);
+        else if (arg == "--group-by" && a + 1 < argc) {
+            string key = argv[++a];
+            if (key != "extension" && key != "owner" && key != "group") {
+                cerr << "unknown group-by key: " << key << '\n';
+                return 1;
+            }
+            groupBy = key == "extension" ? GroupKey::Extension : key == "owner" ? GroupKey::Owner : GroupKey::Group;
+        }
+        else if (arg == "--stat" && a + 1 < argc)
+            statMode = string(argv[++a]) == "threads" ? StatMode::Threads : StatMode::Uring;
+        else if (arg.rfind("--bench-", 0) == 0) {
+            bench = arg;
+            while (a + 1 < argc && string(argv[a + 1]).rfind("--", 0) != 0)
+                benchArgs.push_back(argv[++a]);
+        }
+    }
+    // Positional benchmark argument i, or fallback
+    auto benchArg = [&benchArgs](size_t i, const string& fallback) { return i < benchArgs.size() ? benchArgs[i] : fallback; };
+
+    if (bench == "--bench-stat")
+        return benchStat(stoul(benchArg(0, "1000000")), benchArg(1, "/dev/shm"), threads);
+    if (bench == "--bench-size")
+        return benchSize(stoul(benchArg(0, "10000000")), threads);
+    if (bench == "--bench-visit")
+        return benchVisit(stoul(benchArg(0, "2000000")), max(1, stoi(benchArg(1, "5"))));
+    if (bench == "--bench-parse")
+        return benchParse(benchArg(0, "/dev/stdin"));
+    if (bench == "--bench-snapshot")
+        return benchSnapshot(stoul(benchArg(0, "2000000")), benchArg(1, "/tmp/DirectoryWalker.snapshot"));
+    if (bench == "--bench-glob")
+        return benchGlob(stoul(benchArg(0, "2000000")));
+    if (bench == "--bench-factory")
+        return benchFactory(threads, stoul(benchArg(0, "10000000")));
+    if (!bench.empty()) {
+        cerr << "unknown benchmark: " << bench << '\n';
+        return 1;
+    }
+
+    if (flyweightStats) {
+        FilePropertiesFactory::enableStats();
+        atexit([] { FilePropertiesFactory::writeStats(cerr); });
+    }
+
+    // The walker needs a directory to start from
+    auto checkDirectory = [](const string& path) {
+        struct stat info{};
+        if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+            cerr << "not a directory: " << path << '\n';
+            return false;
+        }
+        return true;
+    };
+
+    if (!watchPath.empty())
+        return Watcher(watchPath, threads, statMode).run(socketPath, cout);
+    if (!dedupPath.empty()) {
+        if (!checkDirectory(dedupPath))
+            return 1;
+        auto top = FilesystemWalker(threads, statMode).walk(dedupPath);
+        DuplicateFinder finder(dedupPath, threads);
+        printDuplicates(finder.find(*top), cout);
+        cerr << "files: " << top->getFileCount() << ", heads hashed: " << finder.headsHashed()
+             << ", hashed fully: " << finder.filesHashedFully() << ", compared: " << finder.filesCompared() << '\n';
+        return 0;
+    }
+
+    // Print the total and the tree of a frozen tree, built or mapped
+    auto reportFrozen = [](const FrozenTree& tree) {
+        SizeVisitor sizeVisitor;
+        tree.accept(sizeVisitor);
+        cout << "total: " << sizeStr(sizeVisitor.getTotal()) << '\n';
+        printTree(tree, FrozenTree::root, "");
+    };
+    if (!diffPaths.empty()) {
+        optional<FrozenTree> before = FrozenTree::load(diffPaths[0]), after = FrozenTree::load(diffPaths[1]);
+        if (!before || !after)
+            return 1;
+        diffTrees(*before, *after, cout);
+        return 0;
+    }
+    if (!loadSnapshot.empty()) {
+        optional<FrozenTree> tree = FrozenTree::load(loadSnapshot);
+        if (!tree)
+            return 1;
+        reportFrozen(*tree);
+        return 0;
+    }
+
+    // The FlatTree is only built from commands and only printed
+    if (flat && (!walkPath.empty() || freeze || !saveSnapshot.empty() || !lookupPath.empty()
+                 || !globs.empty() || topK || groupBy)) {
+        cerr << "--flat cannot be combined with --walk, --freeze, --save-snapshot, --lookup, --glob, --top or --group-by\n";
+        return 1;
+    }
+
+    int inputFd = 0;
+    if (!inputPath.empty() && (inputFd = open(inputPath.c_str(), O_RDONLY | O_CLOEXEC)) < 0) {
+        cerr << "cannot open " << inputPath << ": " << strerror(errno) << '\n';
+        return 1;
+    }
+
+    if (flat) {
+        FlatTreeBuilder builder;
+        InputBuffer input(inputFd);
+        readCommands(input.text(), builder);
+        if (size_t rejected = builder.rejectedCommands()) {
+            cerr << "--flat cannot apply RM, MV or RESIZE (" << rejected << " commands)\n";
+            return 1;
+        }
+        const FlatTree& tree = builder.getTree();
+
+        SizeVisitor sizeVisitor;
+        tree.accept(sizeVisitor);
+        cout << "total: " << sizeStr(sizeVisitor.getTotal()) << '\n';
+        printTree(tree, FlatTree::root, "");
+        return 0;
+    }
+
+    shared_ptr<Directory> root;
+    unique_ptr<PathIndex> index;
+    if (!walkPath.empty()) {
+        if (!checkDirectory(walkPath))
+            return 1;
+        FilesystemWalker walker(threads, statMode);
+        root = walker.walk(walkPath);
+        if (!lookupPath.empty())
+            index = PathIndex::build(*root);
+    } else {
+        TreeBuilder builder;
+        if (!lookupPath.empty())
+            builder.indexPaths();
+        InputBuffer input(inputFd);
+        readCommands(input.text(), builder);
+        root = builder.getRoot();
+        index = builder.takeIndex();
+        if (!threadsGiven)
+            threads = 1;
+    }
+
+    if (!lookupPath.empty()) {
+        int fd = open(lookupPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            cerr << "cannot open " << lookupPath << ": " << strerror(errno) << '\n';
+            return 1;
+        }
+        InputBuffer queries(fd);
+        close(fd);
+        lookupPaths(*index, queries.text(), cout);
+        return 0;
+    }
+
+    if (!globs.empty()) {
+        GlobFilter filter(globs);
+        GlobSizeVisitor visitor(filter);
+        visitor.visit(*root);
+        cout << "total: " << sizeStr(visitor.getTotal()) << " (" << visitor.getFileCount() << " files)\n";
+        return 0;
+    }
+
+    if (topK) {
+        TopK top(*topK);
+        if (threads > 1) {
+            WorkStealingPool pool(threads);
+            top.scan(pool, *root);
+        } else {
+            top.scan(*root);
+        }
+        printTopK(top, cout);
+        return 0;
+    }
+
+    if (groupBy) {
+        GroupBySize groups;
+        if (threads > 1) {
+            WorkStealingPool pool(threads);
+            groups.scan(pool, *root);
+        } else {
+            groups.scan(*root);
+        }
+        printGroups(groups.report(*groupBy), cout);
+        return 0;
+    }
+
+    if (freeze || !saveSnapshot.empty()) {
+        FrozenTree tree = FrozenTree::freeze(*root);
+        if (!saveSnapshot.empty() && !tree.save(saveSnapshot))
+            return 1;
+        reportFrozen(tree);
+        return 0;
+    }
+    report(root, threads);
     return 0;
 }
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Run DirectoryWalker on every tests/NAME.txt and compare with tests/NAME.expected
+# usage: tests/run.sh [BINARY], BINARY defaults to ./DirectoryWalker
+binary=${1:-./DirectoryWalker}
+dir=$(dirname "$0")
+failed=0
+for input in "$dir"/*.txt; do
+    name=${input%.txt}
+    if "$binary" --input "$input" | diff -u "$name.expected" -; then
+        echo "ok   $(basename "$name")"
+    else
+        echo "FAIL $(basename "$name")"
+        failed=1
+    fi
+done
+exit $failed